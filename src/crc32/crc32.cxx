@@ -41,9 +41,19 @@
  */
 
 #include "crc32.hxx"
+
 #include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32_HAVE_PCLMUL 1
+#include <immintrin.h>
+#else
+#define CRC32_HAVE_PCLMUL 0
+#endif
 
-static std::array<unsigned int, 256> crc32_table =
+static constexpr std::array<uint32_t, 256> crc32_table =
 {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
 	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -90,15 +100,236 @@ static std::array<unsigned int, 256> crc32_table =
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-unsigned int crc32(const void *buf, size_t size)
+// Slicing-by-8: crc32_slices[k][b] is the CRC of byte b followed by k zero bytes, so eight
+// independent lookups advance the CRC by eight bytes at once.
+static constexpr std::array<std::array<uint32_t, 256>, 8> make_slices()
 {
-	unsigned int crc = ~0U;
-	auto p = static_cast<const unsigned char*>(buf);
+	std::array<std::array<uint32_t, 256>, 8> slices {};
+	for(std::size_t i = 0; i < 256; i++)
+	{
+		slices[0][i] = crc32_table[i];
+	}
+
+	for(std::size_t k = 1; k < 8; k++)
+	{
+		for(std::size_t i = 0; i < 256; i++)
+		{
+			uint32_t prev = slices[k - 1][i];
+			slices[k][i] = (prev >> 8) ^ crc32_table[prev & 0xff];
+		}
+	}
+
+	return slices;
+}
 
+static constexpr std::array<std::array<uint32_t, 256>, 8> crc32_slices = make_slices();
+
+// all update functions work on the inverted CRC register
+static uint32_t update_bytewise(uint32_t crc, const uint8_t *p, size_t size)
+{
 	while(size--)
 	{
-		crc = crc32_table.at((crc ^ *p++) & 0xFF) ^ (crc >> 8);
+		crc = crc32_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+static uint32_t update_slicing_by_8(uint32_t crc, const uint8_t *p, size_t size)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for(; size >= 8; size -= 8, p += 8)
+	{
+		uint32_t one, two;
+		std::memcpy(&one, p, sizeof(one));
+		std::memcpy(&two, p + 4, sizeof(two));
+		one ^= crc;
+
+		crc = crc32_slices[7][one & 0xff] ^
+		      crc32_slices[6][(one >> 8) & 0xff] ^
+		      crc32_slices[5][(one >> 16) & 0xff] ^
+		      crc32_slices[4][one >> 24] ^
+		      crc32_slices[3][two & 0xff] ^
+		      crc32_slices[2][(two >> 8) & 0xff] ^
+		      crc32_slices[1][(two >> 16) & 0xff] ^
+		      crc32_slices[0][two >> 24];
+	}
+#endif
+
+	return update_bytewise(crc, p, size);
+}
+
+#if CRC32_HAVE_PCLMUL
+// Folding with carry-less multiplication, after "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ Instruction" (Intel, 2009). Four 128-bit lanes are folded 64 bytes at a time,
+// merged into one lane and Barrett-reduced to 32 bits. Constants are for the bit-reflected
+// 0xedb88320 polynomial. Takes size >= 64 and a multiple of 16.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t fold_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+	alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+	alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+	alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00));
+	x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10));
+	x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20));
+	x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+
+	p += 64;
+	size -= 64;
+
+	// fold four lanes in parallel
+	while(size >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00));
+		y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10));
+		y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20));
+		y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		p += 64;
+		size -= 64;
+	}
+
+	// fold the four lanes into one
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// remaining 16-byte blocks
+	while(size >= 16)
+	{
+		x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		p += 16;
+		size -= 16;
 	}
 
-	return crc ^ ~0U;
+	// 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+static uint32_t update_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	if(size >= 64)
+	{
+		size_t chunk = size & ~size_t(15);
+		crc = fold_pclmul(crc, p, chunk);
+		p += chunk;
+		size -= chunk;
+	}
+
+	return update_slicing_by_8(crc, p, size);
+}
+#endif
+
+bool crc32_supported(crc32_implementation implementation)
+{
+	switch(implementation)
+	{
+		case CRC32_BYTEWISE:
+		case CRC32_SLICING_BY_8:
+			return true;
+		case CRC32_PCLMUL:
+#if CRC32_HAVE_PCLMUL
+			return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#else
+			return false;
+#endif
+	}
+
+	return false;
+}
+
+unsigned int crc32_update(crc32_implementation implementation, unsigned int crc, const void *buf, size_t size)
+{
+	auto p = static_cast<const uint8_t*>(buf);
+	uint32_t state = ~static_cast<uint32_t>(crc);
+
+	switch(implementation)
+	{
+		case CRC32_BYTEWISE:
+			state = update_bytewise(state, p, size);
+			break;
+		case CRC32_SLICING_BY_8:
+			state = update_slicing_by_8(state, p, size);
+			break;
+		case CRC32_PCLMUL:
+#if CRC32_HAVE_PCLMUL
+			state = update_pclmul(state, p, size);
+#else
+			state = update_slicing_by_8(state, p, size);
+#endif
+			break;
+	}
+
+	return ~state;
+}
+
+unsigned int crc32_update(unsigned int crc, const void *buf, size_t size)
+{
+	// picked once, on the first call
+	static const crc32_implementation best = crc32_supported(CRC32_PCLMUL) ? CRC32_PCLMUL : CRC32_SLICING_BY_8;
+	return crc32_update(best, crc, buf, size);
+}
+
+unsigned int crc32(const void *buf, size_t size)
+{
+	return crc32_update(0, buf, size);
 }
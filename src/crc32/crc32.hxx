@@ -2,4 +2,18 @@
 
 #include "stddef.h"
 
+enum crc32_implementation
+{
+	CRC32_BYTEWISE,
+	CRC32_SLICING_BY_8,
+	CRC32_PCLMUL, // x86-64 with PCLMULQDQ and SSE4.1, checked at run time
+};
+
 unsigned int crc32(const void *buf, size_t size);
+
+// Continues a CRC over the next block: crc is the result of the previous call, 0 for the first
+// block. crc32_update(crc32(a, n), b, m) equals the CRC of a and b concatenated.
+unsigned int crc32_update(unsigned int crc, const void *buf, size_t size);
+
+bool crc32_supported(crc32_implementation implementation);
+unsigned int crc32_update(crc32_implementation implementation, unsigned int crc, const void *buf, size_t size);
@@ -0,0 +1,272 @@
+#define FUSE_USE_VERSION 31
+
+#include "db_mount.hxx"
+#include "xray_re/xr_file_system.hxx"
+
+#include <fuse.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace xray_re;
+
+static std::string_view trim_path(std::string_view path)
+{
+	while(!path.empty() && (path.front() == '/' || path.front() == '\\'))
+	{
+		path.remove_prefix(1);
+	}
+	while(!path.empty() && (path.back() == '/' || path.back() == '\\'))
+	{
+		path.remove_suffix(1);
+	}
+	return path;
+}
+
+static std::string folder_key(std::string_view path)
+{
+	std::string key(trim_path(path));
+	std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return c == '\\' ? '/' : std::tolower(c); });
+	return key;
+}
+
+static db_mount* mount_instance()
+{
+	return static_cast<db_mount*>(fuse_get_context()->private_data);
+}
+
+static int fuse_getattr(const char *path, struct stat *st, fuse_file_info*)
+{
+	return mount_instance()->getattr(path, st);
+}
+
+static int fuse_open(const char *path, fuse_file_info *fi)
+{
+	if((fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		return -EROFS;
+	}
+
+	// contents never change under the mount
+	fi->keep_cache = 1;
+	return mount_instance()->open(path, fi->fh);
+}
+
+static int fuse_read(const char*, char *buffer, size_t size, off_t offset, fuse_file_info *fi)
+{
+	return mount_instance()->read(fi->fh, buffer, size, offset);
+}
+
+static int fuse_release(const char*, fuse_file_info *fi)
+{
+	mount_instance()->release(fi->fh);
+	return 0;
+}
+
+static int fuse_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t, fuse_file_info*, fuse_readdir_flags)
+{
+	filler(buffer, ".", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+	filler(buffer, "..", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+	return mount_instance()->list(path, [buffer, filler](const std::string& name, bool)
+	{
+		filler(buffer, name.c_str(), nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+	});
+}
+
+static void* fuse_init(fuse_conn_info*, fuse_config *cfg)
+{
+	cfg->kernel_cache = 1;
+	return mount_instance();
+}
+
+void db_mount::set_memory_limit(size_t bytes) { m_memory_limit = bytes; }
+void db_mount::set_cache_size(size_t bytes) { m_cache_size = bytes; }
+
+bool db_mount::process(const std::vector<std::string>& source_paths, const std::string& mount_point, const db_version& version)
+{
+	if(version == DB_VERSION_AUTO)
+	{
+		spdlog::error("unspecified DB format");
+		return false;
+	}
+
+	if(!xr_file_system::folder_exist(mount_point))
+	{
+		spdlog::error("Mount point \"{}\" doesn't exist", mount_point);
+		return false;
+	}
+
+	m_cache = m_cache_size != 0 ? std::make_unique<db_entry_cache>(m_cache_size) : nullptr;
+	m_overlay.set_memory_limit(m_memory_limit);
+	m_overlay.set_cache(m_cache.get());
+	if(!m_overlay.open(source_paths, version))
+	{
+		return false;
+	}
+
+	m_folders.clear();
+	m_folders[""];
+	for(const auto& archive : m_overlay.archives())
+	{
+		m_mtime = std::max<time_t>(m_mtime, xr_file_system::file_age(archive->path()));
+		for(const auto& path : archive->folders())
+		{
+			add_folder(path);
+		}
+	}
+
+	for(const auto& entry : m_overlay.entries())
+	{
+		const std::string& path = entry.file->path;
+		size_t slash = path.rfind('/');
+		std::string parent = slash == std::string::npos ? std::string() : path.substr(0, slash);
+		add_folder(parent);
+		add_child(folder_key(parent), path.substr(slash + 1), false);
+	}
+
+	spdlog::info("Mounting {} files from {} archives on {}", m_overlay.entries().size(), m_overlay.archives().size(), mount_point);
+
+	fuse_operations operations {};
+	operations.getattr = fuse_getattr;
+	operations.open = fuse_open;
+	operations.read = fuse_read;
+	operations.release = fuse_release;
+	operations.readdir = fuse_readdir;
+	operations.init = fuse_init;
+
+	// runs in the foreground until fusermount -u, the archives stay mapped by this process
+	std::string options = "ro,default_permissions,fsname=" + source_paths.front();
+	std::vector<const char*> args = {"db_converter", "-f", "-o", options.c_str(), mount_point.c_str()};
+	int result = fuse_main(static_cast<int>(args.size()), const_cast<char**>(args.data()), &operations, this);
+
+	if(m_cache != nullptr)
+	{
+		db_entry_cache::stats stats = m_cache->get_stats();
+		spdlog::info("entry cache: {} hits, {} misses, {} evictions, {} entries of {} bytes kept",
+			stats.hits, stats.misses, stats.evictions, stats.entries, stats.size);
+	}
+
+	m_overlay.close();
+	return result == 0;
+}
+
+void db_mount::add_folder(const std::string& path)
+{
+	std::string_view trimmed = trim_path(path);
+	if(trimmed.empty() || m_folders.count(folder_key(trimmed)) != 0)
+	{
+		return;
+	}
+
+	// the name keeps the case of its first appearance
+	size_t slash = trimmed.find_last_of("/\\");
+	std::string parent(slash == std::string_view::npos ? std::string_view() : trimmed.substr(0, slash));
+	add_folder(parent);
+	m_folders[folder_key(trimmed)];
+	add_child(folder_key(parent), std::string(trimmed.substr(slash + 1)), true);
+}
+
+void db_mount::add_child(const std::string& parent, const std::string& name, bool is_folder)
+{
+	folder& f = m_folders[parent];
+	f.names.push_back(name);
+	f.folders.push_back(is_folder);
+}
+
+const db_mount::folder* db_mount::find_folder(const char *path) const
+{
+	auto it = m_folders.find(folder_key(path));
+	return it == m_folders.end() ? nullptr : &it->second;
+}
+
+int db_mount::getattr(const char *path, struct stat *st) const
+{
+	memset(st, 0, sizeof(*st));
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+	st->st_mtime = m_mtime;
+	st->st_atime = m_mtime;
+	st->st_ctime = m_mtime;
+
+	if(find_folder(path) != nullptr)
+	{
+		st->st_mode = S_IFDIR | 0555;
+		st->st_nlink = 2;
+		return 0;
+	}
+
+	const db_overlay::entry *entry = m_overlay.find(folder_key(path));
+	if(entry == nullptr)
+	{
+		return -ENOENT;
+	}
+
+	st->st_mode = S_IFREG | 0444;
+	st->st_nlink = 1;
+	st->st_size = entry->file->size_real;
+	st->st_blocks = (entry->file->size_real + 511) / 512;
+	return 0;
+}
+
+int db_mount::open(const char *path, uint64_t& handle) const
+{
+	const db_overlay::entry *entry = m_overlay.find(folder_key(path));
+	if(entry == nullptr)
+	{
+		return find_folder(path) != nullptr ? -EISDIR : -ENOENT;
+	}
+
+	auto file = std::make_unique<open_file>(open_file{entry, nullptr});
+	if(entry->archive->is_compressed(*entry->file) || entry->archive->raw_data(*entry->file) == nullptr)
+	{
+		file->data = entry->archive->read_shared(*entry->file);
+		if(file->data == nullptr)
+		{
+			return -EIO;
+		}
+	}
+
+	handle = reinterpret_cast<uint64_t>(file.release());
+	return 0;
+}
+
+int db_mount::read(uint64_t handle, char *buffer, size_t size, off_t offset) const
+{
+	const open_file& file = *reinterpret_cast<const open_file*>(handle);
+	size_t size_real = file.entry->file->size_real;
+	if(offset < 0 || static_cast<uint64_t>(offset) >= size_real)
+	{
+		return 0;
+	}
+	size = std::min<size_t>(size, size_real - offset);
+
+	const uint8_t *data = file.data != nullptr ? file.data->data() : file.entry->archive->raw_data(*file.entry->file);
+	memcpy(buffer, data + offset, size);
+	return static_cast<int>(size);
+}
+
+void db_mount::release(uint64_t handle) const
+{
+	delete reinterpret_cast<open_file*>(handle);
+}
+
+int db_mount::list(const char *path, const std::function<void(const std::string& name, bool folder)>& func) const
+{
+	const folder *f = find_folder(path);
+	if(f == nullptr)
+	{
+		return -ENOENT;
+	}
+
+	for(size_t i = 0; i < f->names.size(); ++i)
+	{
+		func(f->names[i], f->folders[i]);
+	}
+	return 0;
+}
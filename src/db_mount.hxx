@@ -0,0 +1,57 @@
+#pragma once
+
+#include "db_tools.hxx"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct stat;
+
+// Read-only FUSE file system over a set of archives, merged the way db_overlay sees them.
+// Stored entries are served straight from the mapped archive, compressed ones are unpacked when
+// opened, through a db_entry_cache shared by all open files.
+class db_mount: public db_tools
+{
+public:
+	// see db_archive::set_memory_limit()
+	void set_memory_limit(size_t bytes);
+	// budget for unpacked entries, 0 unpacks on every open
+	void set_cache_size(size_t bytes);
+
+	// blocks until the file system is unmounted
+	bool process(const std::vector<std::string>& source_paths, const std::string& mount_point, const db_version& version);
+
+	// FUSE callbacks, paths are absolute within the mount
+	int getattr(const char *path, struct stat *st) const;
+	int open(const char *path, uint64_t& handle) const;
+	int read(uint64_t handle, char *buffer, size_t size, off_t offset) const;
+	void release(uint64_t handle) const;
+	int list(const char *path, const std::function<void(const std::string& name, bool folder)>& func) const;
+
+protected:
+	struct folder
+	{
+		std::vector<std::string> names;
+		std::vector<bool> folders;
+	};
+
+	void add_folder(const std::string& path);
+	void add_child(const std::string& parent, const std::string& name, bool is_folder);
+	const folder* find_folder(const char *path) const;
+
+	struct open_file
+	{
+		const db_overlay::entry *entry;
+		db_entry_cache::data_ptr data; // unless read from the mapping
+	};
+
+protected:
+	size_t m_memory_limit = 0;
+	size_t m_cache_size = 64 * 1024 * 1024;
+	std::unique_ptr<db_entry_cache> m_cache;
+	db_overlay m_overlay;
+	std::unordered_map<std::string, folder> m_folders; // keyed by lowercase path, "" is the root
+	time_t m_mtime = 0;
+};
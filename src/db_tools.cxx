@@ -3,21 +3,37 @@
 #include "xray_re/xr_lzhuf.hxx"
 #include "xray_re/xr_file_system.hxx"
 #include "xray_re/xr_utils.hxx"
+#include "xray_re/xr_thread_pool.hxx"
+#include "xray_re/xr_hash.hxx"
 #include "lzo/minilzo.h"
 #include "crc32/crc32.hxx"
 
 #include <spdlog/spdlog.h>
 
+#include <cctype>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <filesystem>
+#include <map>
+#include <memory>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace xray_re;
 
 bool db_tools::m_debug = false;
 
+// packed files are stored as is; LZHUF-compressed data blocks are not produced yet
+static constexpr bool compress_files = false;
+
 bool db_tools::is_xrp(const std::string& extension)
 {
 	return extension == ".xrp";
@@ -31,8 +47,8 @@ bool db_tools::is_xp(const std::string& extension)
 
 bool db_tools::is_xdb(const std::string& extension)
 {
-	return (extension.size() == 3 && extension == ".xdb") ||
-	       (extension.size() == 4 && extension.compare(0, 3, ".xdb") == 0 && std::isalnum(extension[4]));
+	return (extension.size() == 4 && extension == ".xdb") ||
+	       (extension.size() == 5 && extension.compare(0, 4, ".xdb") == 0 && std::isalnum(extension[4]));
 }
 
 bool db_tools::is_db(const std::string& extension)
@@ -51,605 +67,3176 @@ void db_tools::set_debug(const bool value)
 	m_debug = value;
 }
 
-static bool write_file(xr_file_system& fs, const std::string& path, const void *data, size_t size)
+void db_tools::write_header(xr_writer& w, const std::vector<std::string>& folders, const std::vector<db_file*>& files, const db_version& version, unsigned int compression_level)
 {
-	xr_writer *w = fs.w_open(path);
-	if(w)
+	xr_memory_writer table;
+
+	// the reverse of read_header_1114/2215/2945/2947
+	auto write_record = [&table, version](std::string path, size_t offset, size_t size_real, size_t size_compressed, uint32_t crc, bool compressed)
 	{
-		w->w_raw(data, size);
-		fs.w_close(w);
+		std::replace(path.begin(), path.end(), '/', '\\');
+		switch(version)
+		{
+			case DB_VERSION_1114:
+				table.w_sz(path);
+				table.w_u32(compressed ? 0 : 1);
+				table.w_size_u32(offset);
+				table.w_size_u32(size_compressed);
+				break;
+			case DB_VERSION_2215:
+				table.w_sz(path);
+				table.w_size_u32(offset);
+				table.w_size_u32(size_real);
+				table.w_size_u32(size_compressed);
+				break;
+			case DB_VERSION_2945:
+				table.w_sz(path);
+				table.w_u32(crc);
+				table.w_size_u32(offset);
+				table.w_size_u32(size_real);
+				table.w_size_u32(size_compressed);
+				break;
+			default:
+				table.w_size_u16(path.size() + 16);
+				table.w_size_u32(size_real);
+				table.w_size_u32(size_compressed);
+				table.w_u32(crc);
+				table.w_raw(path.data(), path.size());
+				table.w_size_u32(offset);
+				break;
+		}
+	};
 
-		return true;
+	for(const auto& folder : folders)
+	{
+		write_record(folder, 0, 0, 0, 0, false);
 	}
 
-	return false;
+	for(const auto *file : files)
+	{
+		write_record(file->path, file->offset, file->size_real, file->size_compressed, file->crc, file->compressed);
+	}
+
+	uint8_t *data = nullptr;
+	uint32_t size = 0;
+	xr_lzhuf::compress(data, size, table.data(), static_cast<uint32_t>(table.tell()), compression_level);
+
+	if(version == DB_VERSION_2947RU)
+	{
+		xr_scrambler scrambler(xr_scrambler::CC_RU);
+		scrambler.encrypt(data, data, size);
+	}
+	else if(version == DB_VERSION_2947WW)
+	{
+		xr_scrambler scrambler(xr_scrambler::CC_WW);
+		scrambler.encrypt(data, data, size);
+	}
+
+	w.open_chunk(DB_CHUNK_HEADER | CHUNK_COMPRESSED);
+	w.w_raw(data, size);
+	w.close_chunk();
+
+	free(data);
 }
 
-void db_unpacker::process(const std::string& source_path, const std::string& destination_path, const db_version& version, const std::string& filter)
+void db_tools::set_jobs(unsigned int jobs)
 {
-	if(version == DB_VERSION_AUTO)
+	m_jobs = jobs;
+}
+
+bool db_tools::db_file::operator<(const db_file& file) const
+{
+	return db_archive::compare_paths(path, file.path) < 0;
+}
+
+db_entry_cache::db_entry_cache(size_t budget, unsigned int shards): m_budget(budget)
+{
+	shards = std::max(shards, 1u);
+	m_shard_budget = budget / shards;
+	m_shards.reserve(shards);
+	for(unsigned int i = 0; i < shards; ++i)
 	{
-		spdlog::error("unspecified DB format");
-		return;
+		m_shards.push_back(std::make_unique<shard>());
 	}
+}
 
-	if(source_path.empty())
+size_t db_entry_cache::budget() const { return m_budget; }
+
+db_entry_cache::shard& db_entry_cache::shard_for(uint64_t key)
+{
+	// offsets of neighbouring entries differ in the low bits only, mix them into the high ones
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	return *m_shards[key % m_shards.size()];
+}
+
+db_entry_cache::data_ptr db_entry_cache::find(uint32_t archive, uint32_t offset)
+{
+	uint64_t key = uint64_t(archive) << 32 | offset;
+	shard& s = shard_for(key);
+
+	std::lock_guard<std::mutex> lock(s.mutex);
+	auto it = s.index.find(key);
+	if(it == s.index.end())
 	{
-		spdlog::error("Missing source file path");
-		return;
+		++m_misses;
+		return nullptr;
 	}
 
-	if(!xr_file_system::file_exist(source_path))
+	++m_hits;
+	s.lru.splice(s.lru.begin(), s.lru, it->second);
+	return it->second->data;
+}
+
+db_entry_cache::data_ptr db_entry_cache::insert(uint32_t archive, uint32_t offset, data_ptr data)
+{
+	if(data == nullptr || data->size() > m_shard_budget)
 	{
-		spdlog::error("File \"{}\" doesn't exist", source_path);
-		return;
+		return data;
 	}
 
-	auto path_splitted = xr_file_system::split_path(source_path);
+	uint64_t key = uint64_t(archive) << 32 | offset;
+	shard& s = shard_for(key);
 
-	std::string output_folder = destination_path.empty() ? path_splitted.folder : destination_path;
-	std::string extension = path_splitted.extension;
+	std::lock_guard<std::mutex> lock(s.mutex);
+	auto it = s.index.find(key);
+	if(it != s.index.end())
+	{
+		return it->second->data;
+	}
 
-	xr_file_system& fs = xr_file_system::instance();
-	xr_reader *reader_full = fs.r_open(source_path);
-	if(reader_full == nullptr)
+	s.lru.push_front({key, data, 0});
+	s.index.emplace(key, s.lru.begin());
+	s.size += data->size();
+	evict(s);
+	return data;
+}
+
+void db_entry_cache::evict(shard& s)
+{
+	for(auto it = s.lru.end(); s.size > m_shard_budget && it != s.lru.begin();)
 	{
-		spdlog::error("Can't load {}", source_path);
-		return;
+		--it;
+		if(it->pins != 0)
+		{
+			continue;
+		}
+
+		s.size -= it->data->size();
+		s.index.erase(it->key);
+		it = s.lru.erase(it);
+		++m_evictions;
 	}
+}
+
+bool db_entry_cache::pin(uint32_t archive, uint32_t offset)
+{
+	uint64_t key = uint64_t(archive) << 32 | offset;
+	shard& s = shard_for(key);
 
-	if(fs.create_path(output_folder))
+	std::lock_guard<std::mutex> lock(s.mutex);
+	auto it = s.index.find(key);
+	if(it == s.index.end())
 	{
-		xr_file_system::append_path_separator(output_folder);
+		return false;
+	}
 
-		xr_scrambler scrambler;
-		xr_reader *reader_chunk = nullptr;
+	++it->second->pins;
+	return true;
+}
 
-		if((reader_chunk = reader_full->open_chunk(DB_CHUNK_USERDATA)) != nullptr)
-		{
-			std::string path = destination_path + "_userdata.ltx";
-			write_file(fs, path, reader_chunk->data(), reader_chunk->size());
-			reader_full->close_chunk(reader_chunk);
-		}
+void db_entry_cache::unpin(uint32_t archive, uint32_t offset)
+{
+	uint64_t key = uint64_t(archive) << 32 | offset;
+	shard& s = shard_for(key);
 
-		switch (version)
-		{
-			case DB_VERSION_1114:
-			case DB_VERSION_2215:
-			case DB_VERSION_2945:
-			case DB_VERSION_XDB:
-			{
-				reader_chunk = reader_full->open_chunk(DB_CHUNK_HEADER);
-				break;
-			}
-			case DB_VERSION_2947RU:
-			{
-				scrambler.init(xr_scrambler::CC_RU);
-				reader_chunk = reader_full->open_chunk(DB_CHUNK_HEADER, scrambler);
-				break;
-			}
-			case DB_VERSION_2947WW:
-			{
-				scrambler.init(xr_scrambler::CC_WW);
-				reader_chunk = reader_full->open_chunk(DB_CHUNK_HEADER, scrambler);
-				break;
-			}
-			default:
-			{
-				spdlog::error("unknown DB format");
-				return;
-			}
-		}
+	std::lock_guard<std::mutex> lock(s.mutex);
+	auto it = s.index.find(key);
+	if(it != s.index.end() && it->second->pins != 0 && --it->second->pins == 0)
+	{
+		evict(s);
+	}
+}
 
-		if(reader_chunk)
-		{
-			const uint8_t *data_full = static_cast<const uint8_t*>(reader_full->data());
-			switch (version)
-			{
-				case DB_VERSION_1114:
-				{
-					extract_1114(output_folder, filter, reader_chunk, data_full);
-					break;
-				}
-				case DB_VERSION_2215:
-				{
-					extract_2215(output_folder, filter, reader_chunk, data_full);
-					break;
-				}
-				case DB_VERSION_2945:
-				{
-					extract_2945(output_folder, filter, reader_chunk, data_full);
-					break;
-				}
-				case DB_VERSION_2947RU:
-				case DB_VERSION_2947WW:
-				case DB_VERSION_XDB:
-				{
-					extract_2947(output_folder, filter, reader_chunk, data_full);
-					break;
-				}
-				default:
-				{
-					spdlog::error("unknown DB format");
-					return;
-				}
-			}
-			reader_full->close_chunk(reader_chunk);
-		}
+void db_entry_cache::clear()
+{
+	for(auto& s : m_shards)
+	{
+		std::lock_guard<std::mutex> lock(s->mutex);
+		s->index.clear();
+		s->lru.clear();
+		s->size = 0;
 	}
-	else
+}
+
+db_entry_cache::stats db_entry_cache::get_stats() const
+{
+	stats result;
+	result.hits = m_hits;
+	result.misses = m_misses;
+	result.evictions = m_evictions;
+	for(const auto& s : m_shards)
 	{
-		spdlog::error("can't create {}", output_folder);
+		std::lock_guard<std::mutex> lock(s->mutex);
+		result.entries += s->index.size();
+		result.size += s->size;
 	}
-	fs.r_close(reader_full);
+	return result;
+}
+
+// reserves part of the memory limit for the lifetime of a stream buffer
+class db_archive::memory_lock
+{
+public:
+	memory_lock(const db_archive& archive, size_t bytes): m_archive(archive), m_bytes(archive.acquire_memory(bytes)) {}
+	~memory_lock() { m_archive.release_memory(m_bytes); }
+
+	memory_lock(const memory_lock& that) = delete;
+	memory_lock& operator=(const memory_lock& right) = delete;
+
+private:
+	const db_archive& m_archive;
+	size_t m_bytes;
+};
+
+static constexpr size_t STREAM_CHUNK_SIZE = 1024 * 1024;
+
+db_archive::~db_archive()
+{
+	close();
 }
 
-static bool write_file(xr_file_system& fs, const std::string& path, const uint8_t *data, uint32_t size_real, uint32_t size_compressed)
+void db_archive::set_memory_limit(size_t bytes) { m_memory_limit = bytes; }
+size_t db_archive::memory_limit() const { return m_memory_limit; }
+void db_archive::set_cache(db_entry_cache *cache) { m_cache = cache; }
+void db_archive::set_filter(const db_filter *filter) { m_filter = filter; }
+uint32_t db_archive::id() const { return m_id; }
+
+bool db_archive::open(const std::string& path, const db_version& version)
 {
-	if(size_real != size_compressed)
+	close();
+
+	if(m_memory_limit == 0)
 	{
-		lzo_uint size = size_real;
-		uint8_t *temp = new uint8_t[size];
-		if(lzo1x_decompress_safe(data, size_compressed, temp, &size, nullptr) != LZO_E_OK)
+		m_reader = xr_file_system::r_open(path);
+		if(m_reader == nullptr)
 		{
-			delete[] temp;
 			return false;
 		}
-		data = temp;
-		size_real = uint32_t(size & UINT32_MAX);
+		m_size = m_reader->size();
 	}
-
-	if(!write_file(fs, path, data, size_real))
+	else
 	{
-		std::string folder = xr_file_system::split_path(path).folder;
-
-		if(xr_file_system::folder_exist(folder))
+		m_file = new xr_file_reader_posix;
+		if(!m_file->open(path))
 		{
-			spdlog::error("Failed to open file \"{}\": {} (errno={}) ", path, strerror(errno), errno);
+			close();
 			return false;
 		}
-		else
+		m_size = m_file->size();
+	}
+
+	static std::atomic<uint32_t> last_id{0};
+	m_id = ++last_id;
+	m_path = path;
+	m_version = version;
+
+	xr_scrambler scrambler;
+	xr_reader *container = open_container(DB_CHUNK_HEADER);
+	xr_reader *reader = nullptr;
+
+	switch (version)
+	{
+		case DB_VERSION_1114:
+		case DB_VERSION_2215:
+		case DB_VERSION_2945:
+		case DB_VERSION_XDB:
 		{
-			if(!fs.create_path(folder))
-			{
-				spdlog::error("Failed to create folder {}", folder);
-				return false;
-			}
+			reader = container ? container->open_chunk(DB_CHUNK_HEADER) : nullptr;
+			break;
 		}
-
-		if((!fs.read_only() && !write_file(fs, path, data, size_real)) || (fs.read_only() && !fs.file_exist(path)))
+		case DB_VERSION_2947RU:
 		{
-			spdlog::error("Failed to open file \"{}\": {} (errno={}) ", path, strerror(errno), errno);
+			scrambler.init(xr_scrambler::CC_RU);
+			reader = container ? container->open_chunk(DB_CHUNK_HEADER, scrambler) : nullptr;
+			break;
+		}
+		case DB_VERSION_2947WW:
+		{
+			scrambler.init(xr_scrambler::CC_WW);
+			reader = container ? container->open_chunk(DB_CHUNK_HEADER, scrambler) : nullptr;
+			break;
+		}
+		default:
+		{
+			spdlog::error("unknown DB format");
+			close_container(container);
+			close();
 			return false;
 		}
 	}
 
-	if(size_real != size_compressed)
+	if(reader == nullptr)
+	{
+		spdlog::error("Can't find the file table in {}", path);
+		close_container(container);
+		close();
+		return false;
+	}
+
+	switch (version)
 	{
-		delete[] data;
+		case DB_VERSION_1114:
+			read_header_1114(reader);
+			break;
+		case DB_VERSION_2215:
+			read_header_2215(reader);
+			break;
+		case DB_VERSION_2945:
+			read_header_2945(reader);
+			break;
+		default:
+			read_header_2947(reader);
+			break;
 	}
+	container->close_chunk(reader);
+	close_container(container);
+
+	m_index.resize(m_files.size());
+	for(uint32_t i = 0; i < m_index.size(); ++i)
+	{
+		m_index[i] = i;
+	}
+
+	std::stable_sort(m_index.begin(), m_index.end(), [this](uint32_t lhs, uint32_t rhs)
+	{
+		return m_files[lhs] < m_files[rhs];
+	});
 
 	return true;
 }
 
-void db_unpacker::extract_1114(const std::string& prefix, const std::string& mask, xr_reader *reader, const uint8_t *data)
+void db_archive::close()
 {
-	xr_file_system& fs = xr_file_system::instance();
-	while(!reader->eof())
-	{
-		std::string name;
-		reader->r_sz(name);
+	xr_file_system::r_close(m_reader);
+	delete m_file;
+	m_file = nullptr;
+	m_size = 0;
+	m_path.clear();
+	m_version = DB_VERSION_AUTO;
+	m_files.clear();
+	m_folders.clear();
+	m_index.clear();
+}
 
-		unsigned uncompressed = reader->r_u32();
-		unsigned offset = reader->r_u32();
-		unsigned size = reader->r_u32();
+bool db_archive::is_open() const { return m_reader != nullptr || m_file != nullptr; }
+const std::string& db_archive::path() const { return m_path; }
+db_tools::db_version db_archive::version() const { return m_version; }
+const std::vector<db_tools::db_file>& db_archive::files() const { return m_files; }
+const std::vector<std::string>& db_archive::folders() const { return m_folders; }
 
-		std::replace(name.begin(), name.end(), '\\', '/');
-		std::string path = prefix + name;
+// reader whose open_chunk() finds the chunk: the whole archive or a window on just that chunk
+xr_reader* db_archive::open_container(uint32_t id) const
+{
+	if(m_reader != nullptr || m_file == nullptr)
+	{
+		return m_reader;
+	}
 
-		if(mask.length() > 0 && offset != 0 && path.find(mask) == std::string::npos)
+	for(size_t offset = 0; offset + 8 <= m_size;)
+	{
+		uint32_t chunk[2];
+		if(!m_file->r_raw(offset, chunk, sizeof(chunk)))
 		{
-			continue;
+			break;
 		}
 
-		spdlog::debug("{}", path);
-		spdlog::debug("  offset: {}", offset);
-
-		if(uncompressed)
-		{
-			spdlog::debug("  size (real): {}", size);
-		}
-		else
+		if((chunk[0] & ~CHUNK_COMPRESSED) == id)
 		{
-			spdlog::debug("  size (compressed): {}", size);
+			return m_file->map(offset, std::min<size_t>(sizeof(chunk) + chunk[1], m_size - offset));
 		}
 
-		if(fs.read_only())
-		{
-			continue;
-		}
+		offset += sizeof(chunk) + chunk[1];
+	}
 
-		auto path_splitted = xr_file_system::split_path(path.append(name));
-		std::string folder = path_splitted.folder;
-		fs.create_path(folder);
+	return nullptr;
+}
 
-		if(uncompressed)
-		{
-			write_file(fs, path, data + offset, size);
-		}
-		else
-		{
-			uint32_t real_size;
-			uint8_t *p;
-			xr_lzhuf::decompress(p, real_size, data + offset, size);
+void db_archive::close_container(xr_reader *&container) const
+{
+	if(container != m_reader)
+	{
+		xr_file_system::r_close(container);
+	}
+	container = nullptr;
+}
 
-			if(real_size)
-			{
-				write_file(fs, path, p, real_size);
-			}
+bool db_archive::read_raw(size_t offset, void *dest, size_t length) const
+{
+	if(m_file != nullptr)
+	{
+		return m_file->r_raw(offset, dest, length);
+	}
 
-			free(p);
-		}
+	if(m_reader == nullptr || offset > m_size || length > m_size - offset)
+	{
+		return false;
 	}
+
+	std::memcpy(dest, static_cast<const uint8_t*>(m_reader->data()) + offset, length);
+	return true;
 }
 
-void db_unpacker::extract_2215(const std::string& prefix, const std::string& mask, xr_reader *reader, const uint8_t *data)
+size_t db_archive::acquire_memory(size_t bytes) const
 {
-	xr_file_system& fs = xr_file_system::instance();
-	while(!reader->eof())
+	if(m_memory_limit == 0)
 	{
-		std::string path;
-		reader->r_sz(path);
-		std::replace(path.begin(), path.end(), '\\', '/');
+		return 0;
+	}
 
-		unsigned offset = reader->r_u32();
-		unsigned size_real = reader->r_u32();
-		unsigned size_compressed = reader->r_u32();
+	// an entry larger than the limit gets the whole of it, the reader is then alone
+	bytes = std::min(bytes, m_memory_limit);
 
-		if(mask.length() > 0 && offset != 0 && path.find(mask) == std::string::npos)
-		{
-			continue;
-		}
+	std::unique_lock<std::mutex> lock(m_memory_mutex);
+	m_memory_cv.wait(lock, [this, bytes] { return m_memory_used + bytes <= m_memory_limit; });
+	m_memory_used += bytes;
+	return bytes;
+}
 
-		spdlog::debug("{}", path);
-		spdlog::debug("  offset: {}", offset);
-		spdlog::debug("  size (real): {}", size_real);
-		spdlog::debug("  size (compressed): {}", size_compressed);
+void db_archive::release_memory(size_t bytes) const
+{
+	if(bytes == 0)
+	{
+		return;
+	}
 
-		if(fs.read_only())
-		{
-			continue;
-		}
+	{
+		std::lock_guard<std::mutex> lock(m_memory_mutex);
+		m_memory_used -= bytes;
+	}
+	m_memory_cv.notify_all();
+}
 
-		if(offset == 0)
-		{
-			fs.create_folder(prefix + path);
-		}
-		else
-		{
-			write_file(fs, prefix + path, data + offset, size_real, size_compressed);
-		}
+// folders are all kept, files only when the filter selects the name as it lies in the header
+bool db_archive::selected(std::string_view name, uint32_t offset) const
+{
+	return offset == 0 || m_filter == nullptr || m_filter->match(name);
+}
+
+void db_archive::add_entry(std::string_view name, uint32_t offset, uint32_t size_real, uint32_t size_compressed, uint32_t crc, bool compressed)
+{
+	std::string path(name);
+	std::replace(path.begin(), path.end(), '\\', '/');
+
+	if(offset == 0)
+	{
+		m_folders.push_back(std::move(path));
+	}
+	else
+	{
+		m_files.push_back({std::move(path), offset, size_real, size_compressed, crc, compressed});
 	}
 }
 
-void db_unpacker::extract_2945(const std::string& prefix, const std::string& mask, xr_reader *reader, const uint8_t *data)
+void db_archive::read_header_1114(xr_reader *reader)
 {
-	xr_file_system& fs = xr_file_system::instance();
 	while(!reader->eof())
 	{
-		std::string path;
-		reader->r_sz(path);
-		std::replace(path.begin(), path.end(), '\\', '/');
+		std::string_view name = reader->skip_sz();
 
-		unsigned crc = reader->r_u32();
+		unsigned uncompressed = reader->r_u32();
 		unsigned offset = reader->r_u32();
-		unsigned size_real = reader->r_u32();
-		unsigned size_compressed = reader->r_u32();
-
-		if(mask.length() > 0 && offset != 0 && path.find(mask) == std::string::npos)
+		unsigned size = reader->r_u32();
+		if(!selected(name, offset))
 		{
 			continue;
 		}
 
-		spdlog::debug("{}", path);
-		spdlog::debug("  crc: {0:#x}", crc);
-		spdlog::debug("  offset: {}", offset);
-		spdlog::debug("  size (real): {}", size_real);
-		spdlog::debug("  size (compressed): {}", size_compressed);
-
-		if(fs.read_only())
+		// LZHUF-compressed entries start with their real size, which is a pread each under a memory limit
+		uint32_t size_real = size;
+		if(offset != 0 && !uncompressed && size >= sizeof(size_real) && !read_raw(offset, &size_real, sizeof(size_real)))
 		{
+			spdlog::error("Can't read the size of \"{}\" in {}, the entry is left out", name, m_path);
 			continue;
 		}
 
-		if(offset == 0)
-		{
-			fs.create_folder(prefix + path);
-		}
-		else
-		{
-			write_file(fs, prefix + path, data + offset, size_real, size_compressed);
-		}
+		add_entry(name, offset, size_real, size, 0, !uncompressed);
 	}
 }
 
-void db_unpacker::extract_2947(const std::string& prefix, const std::string& mask, xr_reader *reader, const uint8_t *data)
+void db_archive::read_header_2215(xr_reader *reader)
 {
-	xr_file_system& fs = xr_file_system::instance();
 	while(!reader->eof())
 	{
-		unsigned int name_size = reader->r_u16() - 16;              // unsigned 2 bytes <─┐
+		std::string_view name = reader->skip_sz();
+
+		unsigned offset = reader->r_u32();
+		unsigned size_real = reader->r_u32();
+		unsigned size_compressed = reader->r_u32();
+
+		if(selected(name, offset))
+		{
+			add_entry(name, offset, size_real, size_compressed, 0, size_real != size_compressed);
+		}
+	}
+}
+
+void db_archive::read_header_2945(xr_reader *reader)
+{
+	while(!reader->eof())
+	{
+		std::string_view name = reader->skip_sz();
+
+		unsigned crc = reader->r_u32();
+		unsigned offset = reader->r_u32();
+		unsigned size_real = reader->r_u32();
+		unsigned size_compressed = reader->r_u32();
+
+		if(selected(name, offset))
+		{
+			add_entry(name, offset, size_real, size_compressed, crc, size_real != size_compressed);
+		}
+	}
+}
+
+void db_archive::read_header_2947(xr_reader *reader)
+{
+	while(!reader->eof())
+	{
+		unsigned int name_size = reader->r_u16() - 16;              // unsigned 2 bytes <─┐
 		unsigned int size_real = reader->r_u32();                   // unsigned 4 bytes   │
 		unsigned int size_compressed = reader->r_u32();             // unsigned 4 bytes   │
 		uint32_t crc = reader->r_u32();                             // unsigned 4 bytes   │
-		std::string name(reader->skip<char>(name_size), name_size); // string   N bytes >─┘
+		std::string_view name(reader->skip<char>(name_size), name_size); // string   N bytes >─┘
 		uint32_t offset = reader->r_u32();                          // unsigned 4 bytes
 
-		std::replace(name.begin(), name.end(), '\\', '/');
-		std::string path = prefix + name;
+		if(selected(name, offset))
+		{
+			add_entry(name, offset, size_real, size_compressed, crc, size_real != size_compressed);
+		}
+	}
+}
+
+int db_archive::compare_paths(std::string_view lhs, std::string_view rhs)
+{
+	auto fold = [](char c) -> int
+	{
+		return c == '\\' ? '/' : std::tolower(static_cast<unsigned char>(c));
+	};
+
+	size_t size = std::min(lhs.size(), rhs.size());
+	for(size_t i = 0; i < size; ++i)
+	{
+		int diff = fold(lhs[i]) - fold(rhs[i]);
+		if(diff != 0)
+		{
+			return diff;
+		}
+	}
+
+	return lhs.size() < rhs.size() ? -1 : (lhs.size() > rhs.size() ? 1 : 0);
+}
+
+const db_tools::db_file* db_archive::find(const std::string& path) const
+{
+	auto it = std::lower_bound(m_index.begin(), m_index.end(), path, [this](uint32_t index, const std::string& value)
+	{
+		return compare_paths(m_files[index].path, value) < 0;
+	});
+
+	if(it == m_index.end() || compare_paths(m_files[*it].path, path) != 0)
+	{
+		return nullptr;
+	}
+
+	return &m_files[*it];
+}
+
+void db_archive::for_each(const std::string& prefix, const std::function<void(const db_file&)>& func) const
+{
+	auto it = std::lower_bound(m_index.begin(), m_index.end(), prefix, [this](uint32_t index, const std::string& value)
+	{
+		return compare_paths(m_files[index].path, value) < 0;
+	});
+
+	for(; it != m_index.end(); ++it)
+	{
+		const db_file& file = m_files[*it];
+		if(file.path.size() < prefix.size() || compare_paths(std::string_view(file.path).substr(0, prefix.size()), prefix) != 0)
+		{
+			break;
+		}
+		func(file);
+	}
+}
+
+const uint8_t* db_archive::raw_data(const db_file& file) const
+{
+	if(m_reader == nullptr || file.offset + file.size_compressed > m_size)
+	{
+		return nullptr;
+	}
+
+	return static_cast<const uint8_t*>(m_reader->data()) + file.offset;
+}
+
+bool db_archive::is_compressed(const db_file& file) const
+{
+	return file.compressed;
+}
+
+int db_archive::fd() const
+{
+	if(m_file != nullptr)
+	{
+		return m_file->fd();
+	}
+
+	auto reader = dynamic_cast<const xr_mmap_reader_posix*>(m_reader);
+	return reader ? reader->fd() : -1;
+}
+
+bool db_archive::read(const std::string& path, std::vector<uint8_t>& buffer) const
+{
+	const db_file *file = find(path);
+	return file != nullptr && read(*file, buffer);
+}
+
+bool db_archive::read(const db_file& file, std::vector<uint8_t>& buffer) const
+{
+	if(m_cache != nullptr && is_compressed(file))
+	{
+		db_entry_cache::data_ptr data = read_shared(file);
+		if(data == nullptr)
+		{
+			return false;
+		}
+		buffer.assign(data->begin(), data->end());
+		return true;
+	}
+
+	memory_lock lock(*this, file.size_real + (is_compressed(file) ? file.size_compressed : 0));
+	std::vector<uint8_t> packed;
+	return read_entry(file, buffer, packed);
+}
+
+// packed holds the compressed bytes when they have to be read from the file
+db_entry_cache::data_ptr db_archive::read_shared(const db_file& file) const
+{
+	bool cached = m_cache != nullptr && is_compressed(file);
+	if(cached)
+	{
+		if(db_entry_cache::data_ptr data = m_cache->find(m_id, file.offset))
+		{
+			return data;
+		}
+	}
+
+	auto data = std::make_shared<std::vector<uint8_t>>();
+	{
+		memory_lock lock(*this, file.size_real + (is_compressed(file) ? file.size_compressed : 0));
+		std::vector<uint8_t> packed;
+		if(!read_entry(file, *data, packed))
+		{
+			return nullptr;
+		}
+	}
+
+	return cached ? m_cache->insert(m_id, file.offset, std::move(data)) : data;
+}
+
+bool db_archive::read_entry(const db_file& file, std::vector<uint8_t>& buffer, std::vector<uint8_t>& packed) const
+{
+	if(file.offset + file.size_compressed > m_size)
+	{
+		spdlog::error("Entry \"{}\" lies outside of {}", file.path, m_path);
+		return false;
+	}
+
+	const uint8_t *data = raw_data(file);
+
+	if(!is_compressed(file))
+	{
+		if(data != nullptr)
+		{
+			buffer.assign(data, data + file.size_real);
+			return true;
+		}
+
+		buffer.resize(file.size_real);
+		return read_raw(file.offset, buffer.data(), file.size_real);
+	}
+
+	if(data == nullptr)
+	{
+		packed.resize(file.size_compressed);
+		if(!read_raw(file.offset, packed.data(), packed.size()))
+		{
+			return false;
+		}
+		data = packed.data();
+	}
+
+	if(m_version == DB_VERSION_1114)
+	{
+		uint8_t *text = nullptr;
+		uint32_t text_size = 0;
+		xr_lzhuf::decompress(text, text_size, data, static_cast<uint32_t>(file.size_compressed));
+		buffer.assign(text, text + text_size);
+		free(text);
+		return true;
+	}
+
+	buffer.resize(file.size_real);
+	lzo_uint size = file.size_real;
+	if(lzo1x_decompress_safe(data, file.size_compressed, buffer.data(), &size, nullptr) != LZO_E_OK || size != file.size_real)
+	{
+		spdlog::error("Failed to decompress \"{}\"", file.path);
+		return false;
+	}
+
+	return true;
+}
+
+bool db_archive::extract(const db_file& file, xr_writer& w, size_t& copied) const
+{
+	copied = 0;
+
+	if(file.offset + file.size_compressed > m_size)
+	{
+		spdlog::error("Entry \"{}\" lies outside of {}", file.path, m_path);
+		return false;
+	}
+
+	if(is_compressed(file))
+	{
+		if(m_cache != nullptr)
+		{
+			db_entry_cache::data_ptr data = read_shared(file);
+			if(data == nullptr)
+			{
+				return false;
+			}
+			w.w_raw(data->data(), data->size());
+			return true;
+		}
+
+		if(m_reader != nullptr)
+		{
+			// the buffer is kept per thread, so it only grows up to the largest entry
+			static thread_local std::vector<uint8_t> buffer, packed;
+			if(!read_entry(file, buffer, packed))
+			{
+				return false;
+			}
+			w.w_raw(buffer.data(), buffer.size());
+			return true;
+		}
+
+		memory_lock lock(*this, file.size_real + file.size_compressed);
+		std::vector<uint8_t> buffer, packed;
+		if(!read_entry(file, buffer, packed))
+		{
+			return false;
+		}
+		w.w_raw(buffer.data(), buffer.size());
+		return true;
+	}
+
+	// stored entries go straight from the archive to the output, sparing the mapping a page fault per page
+	auto posix_writer = dynamic_cast<xr_file_writer_posix*>(&w);
+	if(posix_writer && fd() != -1 && posix_writer->w_copy(fd(), file.offset, file.size_real))
+	{
+		copied = file.size_real;
+		return true;
+	}
+
+	if(const uint8_t *data = raw_data(file))
+	{
+		w.w_raw(data, file.size_real);
+		return true;
+	}
+
+	size_t chunk_size = std::min(file.size_real, std::min(STREAM_CHUNK_SIZE, m_memory_limit));
+	memory_lock lock(*this, chunk_size);
+	std::vector<uint8_t> chunk(chunk_size);
+	for(size_t done = 0; done < file.size_real; done += chunk_size)
+	{
+		size_t size = std::min(chunk_size, file.size_real - done);
+		if(!read_raw(file.offset + done, chunk.data(), size))
+		{
+			spdlog::error("Failed to read \"{}\" from {}", file.path, m_path);
+			return false;
+		}
+		w.w_raw(chunk.data(), size);
+	}
+
+	return true;
+}
+
+bool db_archive::read_userdata(std::vector<uint8_t>& buffer) const
+{
+	xr_reader *container = open_container(DB_CHUNK_USERDATA);
+	xr_reader *reader = container ? container->open_chunk(DB_CHUNK_USERDATA) : nullptr;
+	if(reader == nullptr)
+	{
+		close_container(container);
+		return false;
+	}
+
+	auto data = static_cast<const uint8_t*>(reader->data());
+	buffer.assign(data, data + reader->size());
+	container->close_chunk(reader);
+	close_container(container);
+	return true;
+}
+
+static bool write_file(xr_file_system& fs, const std::string& path, const void *data, size_t size)
+{
+	xr_writer *w = fs.w_open(path);
+	if(w)
+	{
+		w->w_raw(data, size);
+		fs.w_close(w);
+
+		return true;
+	}
+
+	return false;
+}
+
+static xr_writer* open_output(xr_file_system& fs, const std::string& path)
+{
+	xr_writer *w = fs.w_open(path);
+	if(w == nullptr)
+	{
+		std::string folder = xr_file_system::split_path(path).folder;
+
+		if(xr_file_system::folder_exist(folder))
+		{
+			spdlog::error("Failed to open file \"{}\": {} (errno={}) ", path, strerror(errno), errno);
+			return nullptr;
+		}
+
+		if(!fs.create_path(folder))
+		{
+			spdlog::error("Failed to create folder {}", folder);
+			return nullptr;
+		}
+
+		w = fs.w_open(path);
+		if(w == nullptr)
+		{
+			spdlog::error("Failed to open file \"{}\": {} (errno={}) ", path, strerror(errno), errno);
+		}
+	}
+
+	return w;
+}
+
+// splits an entry path into its folder and name
+static std::pair<std::string_view, std::string_view> split_entry_path(const std::string& path)
+{
+	size_t slash = path.rfind('/');
+	if(slash == std::string::npos)
+	{
+		return {std::string_view(), path};
+	}
+
+	return {std::string_view(path).substr(0, slash), std::string_view(path).substr(slash + 1)};
+}
+
+// copied is set to the number of bytes that never left the kernel
+static bool write_file(xr_file_system& fs, const std::string& prefix, const xr_folder_cache& folders, const db_archive& archive,
+	const db_tools::db_file& file, size_t direct_io_threshold, size_t& copied)
+{
+	copied = 0;
+
+	auto [folder, name] = split_entry_path(file.path);
+	int dirfd = folders.fd(folder);
+	std::string path = dirfd != -1 ? std::string(name) : prefix + file.path;
+	if(dirfd == -1)
+	{
+		dirfd = AT_FDCWD;
+	}
+
+	xr_writer *w = nullptr;
+	if(direct_io_threshold != 0 && file.size_real >= direct_io_threshold)
+	{
+		w = fs.w_open_direct_at(dirfd, path);
+	}
+
+	if(w == nullptr)
+	{
+		w = fs.w_open_at(dirfd, path);
+	}
+
+	if(w == nullptr)
+	{
+		dirfd = AT_FDCWD;
+		path = prefix + file.path;
+		w = open_output(fs, path);
+		if(w == nullptr)
+		{
+			return false;
+		}
+	}
+
+	w->reserve(file.size_real);
+	bool ok = archive.extract(file, *w, copied);
+	fs.w_close(w);
+
+	if(!ok)
+	{
+		// don't leave a truncated file that looks extracted
+		::unlinkat(dirfd, path.c_str(), 0);
+	}
+
+	return ok;
+}
+
+void db_overlay::set_memory_limit(size_t bytes) { m_memory_limit = bytes; }
+void db_overlay::set_cache(db_entry_cache *cache) { m_cache = cache; }
+void db_overlay::set_filter(const db_filter *filter) { m_filter = filter; }
+bool db_overlay::is_open() const { return !m_archives.empty(); }
+const std::vector<std::unique_ptr<db_archive>>& db_overlay::archives() const { return m_archives; }
+const std::vector<db_overlay::entry>& db_overlay::entries() const { return m_entries; }
+size_t db_overlay::overridden() const { return m_overridden; }
+
+bool db_overlay::open(const std::vector<std::string>& paths, const db_version& version)
+{
+	close();
+
+	// archives read concurrently share the memory limit
+	size_t memory_limit = m_memory_limit && !paths.empty() ? std::max<size_t>(m_memory_limit / paths.size(), 1) : 0;
+
+	for(const auto& path : paths)
+	{
+		auto archive = std::make_unique<db_archive>();
+		archive->set_memory_limit(memory_limit);
+		archive->set_cache(m_cache);
+		archive->set_filter(m_filter);
+		if(!archive->open(path, version))
+		{
+			spdlog::error("Can't load {}", path);
+			close();
+			return false;
+		}
+		m_archives.push_back(std::move(archive));
+	}
+
+	std::vector<entry> candidates;
+	for(const auto& archive : m_archives)
+	{
+		for(const auto& file : archive->files())
+		{
+			candidates.push_back({archive.get(), &file});
+		}
+	}
+
+	// equal paths keep mount order, so the last of each run wins
+	std::vector<uint32_t> order(candidates.size());
+	for(uint32_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&candidates](uint32_t lhs, uint32_t rhs)
+	{
+		return db_archive::compare_paths(candidates[lhs].file->path, candidates[rhs].file->path) < 0;
+	});
+
+	std::vector<bool> winners(candidates.size(), true);
+	for(size_t i = 1; i < order.size(); ++i)
+	{
+		if(db_archive::compare_paths(candidates[order[i - 1]].file->path, candidates[order[i]].file->path) == 0)
+		{
+			winners[order[i - 1]] = false;
+			++m_overridden;
+		}
+	}
+
+	std::vector<uint32_t> positions(candidates.size());
+	for(size_t i = 0; i < candidates.size(); ++i)
+	{
+		positions[i] = static_cast<uint32_t>(m_entries.size());
+		if(winners[i])
+		{
+			m_entries.push_back(candidates[i]);
+		}
+	}
+
+	m_index.reserve(m_entries.size());
+	for(uint32_t i : order)
+	{
+		if(winners[i])
+		{
+			m_index.push_back(positions[i]);
+		}
+	}
+
+	return true;
+}
+
+void db_overlay::close()
+{
+	m_index.clear();
+	m_entries.clear();
+	m_archives.clear();
+	m_overridden = 0;
+}
+
+const db_overlay::entry* db_overlay::find(const std::string& path) const
+{
+	auto it = std::lower_bound(m_index.begin(), m_index.end(), path, [this](uint32_t index, const std::string& value)
+	{
+		return db_archive::compare_paths(m_entries[index].file->path, value) < 0;
+	});
+
+	if(it == m_index.end() || db_archive::compare_paths(m_entries[*it].file->path, path) != 0)
+	{
+		return nullptr;
+	}
+
+	return &m_entries[*it];
+}
+
+bool db_overlay::stat(const std::string& path, db_file& file) const
+{
+	const entry *e = find(path);
+	if(e == nullptr)
+	{
+		return false;
+	}
+
+	file = *e->file;
+	return true;
+}
+
+bool db_overlay::read(const std::string& path, std::vector<uint8_t>& buffer) const
+{
+	const entry *e = find(path);
+	return e != nullptr && e->archive->read(*e->file, buffer);
+}
+
+xr_reader* db_overlay::open_reader(const std::string& path) const
+{
+	const entry *e = find(path);
+	if(e == nullptr)
+	{
+		return nullptr;
+	}
+
+	// stored entries of a mapped archive are read in place
+	const uint8_t *data = e->archive->is_compressed(*e->file) ? nullptr : e->archive->raw_data(*e->file);
+	if(data != nullptr)
+	{
+		return new xr_reader(data, e->file->size_real);
+	}
+
+	std::vector<uint8_t> buffer;
+	if(!e->archive->read(*e->file, buffer))
+	{
+		return nullptr;
+	}
+
+	auto copy = static_cast<uint8_t*>(malloc(std::max<size_t>(buffer.size(), 1)));
+	std::copy(buffer.begin(), buffer.end(), copy);
+	return new xr_temp_reader(copy, buffer.size());
+}
+
+void db_overlay::list(const std::string& prefix, const std::function<void(const entry&)>& func) const
+{
+	auto it = std::lower_bound(m_index.begin(), m_index.end(), prefix, [this](uint32_t index, const std::string& value)
+	{
+		return db_archive::compare_paths(m_entries[index].file->path, value) < 0;
+	});
+
+	for(; it != m_index.end(); ++it)
+	{
+		const entry& e = m_entries[*it];
+		if(e.file->path.size() < prefix.size() || db_archive::compare_paths(std::string_view(e.file->path).substr(0, prefix.size()), prefix) != 0)
+		{
+			break;
+		}
+		func(e);
+	}
+}
+
+struct db_cache::record
+{
+	entry value;
+	uint32_t name_offset;
+	uint32_t name_size;
+};
+
+namespace
+{
+	struct db_cache_header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t count;
+		uint32_t names_size;
+	};
+
+	constexpr uint32_t DB_CACHE_MAGIC = 0x43424458; // "XDBC"
+	constexpr uint32_t DB_CACHE_VERSION = 2;
+}
+
+db_cache::~db_cache()
+{
+	clear();
+}
+
+void db_cache::clear()
+{
+	xr_file_system::r_close(m_reader);
+	m_records = nullptr;
+	m_count = 0;
+	m_names = nullptr;
+	m_added.clear();
+}
+
+std::string db_cache::key(const std::string& path)
+{
+	std::string result = path;
+	for(auto& c : result)
+	{
+		c = c == '\\' ? '/' : static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	}
+	return result;
+}
+
+std::string db_cache::path_for(const std::string& archive_path)
+{
+	return archive_path + ".cache";
+}
+
+std::string_view db_cache::name(const record& r) const
+{
+	return std::string_view(m_names + r.name_offset, r.name_size);
+}
+
+size_t db_cache::size() const { return m_count; }
+
+const db_cache::entry* db_cache::find(const std::string& path) const
+{
+	std::string k = key(path);
+	const record *end = m_records + m_count;
+	const record *it = std::lower_bound(m_records, end, std::string_view(k), [this](const record& r, std::string_view value) { return name(r) < value; });
+	return it != end && name(*it) == k ? &it->value : nullptr;
+}
+
+void db_cache::add(const std::string& path, const entry& value)
+{
+	m_added.emplace_back(key(path), value);
+}
+
+bool db_cache::load(const std::string& path)
+{
+	clear();
+
+	if(!xr_file_system::file_exist(path))
+	{
+		return false;
+	}
+
+	m_reader = xr_file_system::r_open(path);
+	if(m_reader == nullptr)
+	{
+		return false;
+	}
+
+	const auto *data = static_cast<const uint8_t*>(m_reader->data());
+	size_t size = m_reader->size();
+
+	db_cache_header header {};
+	if(size >= sizeof(header))
+	{
+		std::memcpy(&header, data, sizeof(header));
+	}
+
+	if(header.magic != DB_CACHE_MAGIC || header.version != DB_CACHE_VERSION ||
+		size != sizeof(header) + size_t(header.count) * sizeof(record) + header.names_size)
+	{
+		spdlog::warn("{} is not a cache of a known version, ignoring it", path);
+		clear();
+		return false;
+	}
+
+	m_records = reinterpret_cast<const record*>(data + sizeof(header));
+	m_names = reinterpret_cast<const char*>(m_records + header.count);
+	m_count = header.count;
+
+	for(size_t i = 0; i != m_count; ++i)
+	{
+		const record& r = m_records[i];
+		if(size_t(r.name_offset) + r.name_size > header.names_size || (i != 0 && !(name(m_records[i - 1]) < name(r))))
+		{
+			spdlog::warn("{} is damaged, ignoring it", path);
+			clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool db_cache::save(const std::string& path) const
+{
+	// the last entry added for a path wins
+	std::vector<const std::pair<std::string, entry>*> entries;
+	entries.reserve(m_added.size());
+	for(const auto& item : m_added)
+	{
+		entries.push_back(&item);
+	}
+	std::stable_sort(entries.begin(), entries.end(), [](const auto *lhs, const auto *rhs) { return lhs->first < rhs->first; });
+
+	std::vector<record> records;
+	std::string names;
+	records.reserve(entries.size());
+	for(size_t i = 0; i != entries.size(); ++i)
+	{
+		if(i + 1 != entries.size() && entries[i + 1]->first == entries[i]->first)
+		{
+			continue;
+		}
+
+		record r {};
+		r.value = entries[i]->second;
+		r.name_offset = static_cast<uint32_t>(names.size());
+		r.name_size = static_cast<uint32_t>(entries[i]->first.size());
+		names += entries[i]->first;
+		records.push_back(r);
+	}
+
+	db_cache_header header { DB_CACHE_MAGIC, DB_CACHE_VERSION, static_cast<uint32_t>(records.size()), static_cast<uint32_t>(names.size()) };
+
+	xr_memory_writer w;
+	w.w_raw(&header, sizeof(header));
+	w.w_raw(records.data(), records.size() * sizeof(record));
+	w.w_raw(names.data(), names.size());
+
+	// written aside and renamed, the old file may still be mapped by whoever loaded it
+	std::string temp_path = path + ".tmp";
+	if(!w.save_to(temp_path))
+	{
+		return false;
+	}
+
+	if(std::rename(temp_path.c_str(), path.c_str()) == -1)
+	{
+		spdlog::error("Can't rename {} to {}: {} (errno={})", temp_path, path, strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+uint8_t db_filter::fold(uint8_t c)
+{
+	return c == '\\' ? '/' : static_cast<uint8_t>(std::tolower(c));
+}
+
+bool db_filter::add(const std::string& pattern)
+{
+	bool result = parse(pattern);
+	compile();
+	return result;
+}
+
+bool db_filter::parse(const std::string& text)
+{
+	std::string_view pattern(text);
+	bool exclude = !pattern.empty() && pattern.front() == '!';
+	if(exclude)
+	{
+		pattern.remove_prefix(1);
+	}
+
+	if(pattern.empty())
+	{
+		spdlog::error("Empty filter pattern \"{}\"", text);
+		return false;
+	}
+
+	m_has_includes |= !exclude;
+
+	if(pattern.substr(0, 3) == "re:")
+	{
+		try
+		{
+			m_regexes.push_back({std::regex(pattern.begin() + 3, pattern.end(),
+				std::regex::ECMAScript | std::regex::icase | std::regex::optimize), exclude});
+		}
+		catch(const std::regex_error& e)
+		{
+			spdlog::error("Bad regular expression \"{}\": {}", text, e.what());
+			return false;
+		}
+		return true;
+	}
+
+	auto literal = [](uint8_t c)
+	{
+		token t {TOKEN_CHAR, std::vector<bool>(256)};
+		t.set[fold(c)] = true;
+		return t;
+	};
+
+	glob g {{}, exclude};
+
+	// a plain string is found anywhere in the path
+	if(pattern.find_first_of("*?[") == std::string_view::npos)
+	{
+		g.tokens.push_back({TOKEN_GLOBSTAR, {}});
+		for(char c : pattern)
+		{
+			g.tokens.push_back(literal(c));
+		}
+		g.tokens.push_back({TOKEN_GLOBSTAR, {}});
+		m_globs.push_back(std::move(g));
+		return true;
+	}
+
+	for(size_t i = 0; i < pattern.size(); ++i)
+	{
+		char c = pattern[i];
+		if(c == '*')
+		{
+			if(i + 1 < pattern.size() && pattern[i + 1] == '*')
+			{
+				while(i + 1 < pattern.size() && pattern[i + 1] == '*')
+				{
+					++i;
+				}
+
+				if(i + 1 < pattern.size() && fold(pattern[i + 1]) == '/')
+				{
+					++i;
+					g.tokens.push_back({TOKEN_FOLDERS, {}});
+				}
+				else
+				{
+					g.tokens.push_back({TOKEN_GLOBSTAR, {}});
+				}
+			}
+			else
+			{
+				g.tokens.push_back({TOKEN_STAR, {}});
+			}
+		}
+		else if(c == '?')
+		{
+			g.tokens.push_back({TOKEN_ANY, {}});
+		}
+		else if(c == '[' && pattern.find(']', i + 2) != std::string_view::npos)
+		{
+			size_t j = i + 1;
+			bool negate = pattern[j] == '!' || pattern[j] == '^';
+			if(negate)
+			{
+				++j;
+			}
+
+			token t {TOKEN_CHAR, std::vector<bool>(256)};
+			// ']' right after the opening bracket is a member
+			for(size_t first = j; j < pattern.size() && (pattern[j] != ']' || j == first); ++j)
+			{
+				uint8_t from = pattern[j], to = from;
+				if(j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+				{
+					to = pattern[j + 2];
+					j += 2;
+				}
+
+				for(unsigned int b = from; b <= to; ++b)
+				{
+					t.set[fold(b)] = true;
+				}
+			}
+
+			if(j == pattern.size())
+			{
+				g.tokens.push_back(literal(c));
+				continue;
+			}
+
+			if(negate)
+			{
+				t.set.flip();
+			}
+			t.set['/'] = false;
+
+			g.tokens.push_back(std::move(t));
+			i = j;
+		}
+		else
+		{
+			g.tokens.push_back(literal(c));
+		}
+	}
+
+	m_globs.push_back(std::move(g));
+	return true;
+}
+
+bool db_filter::load(const std::string& path)
+{
+	xr_reader *reader = xr_file_system::r_open(path);
+	if(reader == nullptr)
+	{
+		spdlog::error("can't load {}", path);
+		return false;
+	}
+
+	std::string_view text(static_cast<const char*>(reader->data()), reader->size());
+	bool result = true;
+	while(!text.empty())
+	{
+		size_t end = std::min(text.find('\n'), text.size());
+		std::string_view line = text.substr(0, end);
+		text.remove_prefix(std::min(end + 1, text.size()));
+
+		while(!line.empty() && std::isspace(static_cast<unsigned char>(line.back())))
+		{
+			line.remove_suffix(1);
+		}
+		while(!line.empty() && std::isspace(static_cast<unsigned char>(line.front())))
+		{
+			line.remove_prefix(1);
+		}
+
+		if(!line.empty() && line.front() != '#')
+		{
+			result &= parse(std::string(line));
+		}
+	}
+
+	xr_file_system::r_close(reader);
+	compile();
+	return result;
+}
+
+bool db_filter::empty() const
+{
+	return m_globs.empty() && m_regexes.empty();
+}
+
+void db_filter::close(state& positions) const
+{
+	// wildcards may match nothing, so the token after them is reachable too
+	for(size_t i = 0; i < positions.size(); ++i)
+	{
+		auto [g, pos] = positions[i];
+		const auto& tokens = m_globs[g].tokens;
+		if(pos < tokens.size() && tokens[pos].type != TOKEN_CHAR && tokens[pos].type != TOKEN_ANY)
+		{
+			positions.emplace_back(g, pos + 1);
+		}
+	}
+
+	std::sort(positions.begin(), positions.end());
+	positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+}
+
+db_filter::state db_filter::step(const state& positions, uint8_t c) const
+{
+	state next;
+	for(auto [g, pos] : positions)
+	{
+		const auto& tokens = m_globs[g].tokens;
+		if(pos == tokens.size())
+		{
+			continue;
+		}
+
+		const token& t = tokens[pos];
+		switch(t.type)
+		{
+			case TOKEN_CHAR:
+				if(t.set[c])
+				{
+					next.emplace_back(g, pos + 1);
+				}
+				break;
+			case TOKEN_ANY:
+				if(c != '/')
+				{
+					next.emplace_back(g, pos + 1);
+				}
+				break;
+			case TOKEN_STAR:
+				if(c != '/')
+				{
+					next.emplace_back(g, pos);
+				}
+				break;
+			case TOKEN_GLOBSTAR:
+				next.emplace_back(g, pos);
+				break;
+			case TOKEN_FOLDERS:
+				next.emplace_back(g, pos);
+				if(c == '/')
+				{
+					next.emplace_back(g, pos + 1);
+				}
+				break;
+		}
+	}
+
+	close(next);
+	return next;
+}
+
+uint8_t db_filter::accepts(const state& positions) const
+{
+	uint8_t flags = 0;
+	for(auto [g, pos] : positions)
+	{
+		if(pos == m_globs[g].tokens.size())
+		{
+			flags |= m_globs[g].exclude ? ACCEPT_EXCLUDE : ACCEPT_INCLUDE;
+		}
+	}
+	return flags;
+}
+
+void db_filter::compile()
+{
+	// the per-thread DFAs of the patterns before are stale now
+	static std::atomic<uint64_t> serials {0};
+	m_serial = ++serials;
+	m_representatives.clear();
+
+	// bytes every token treats alike share a class, which keeps the transition table small
+	std::vector<const std::vector<bool>*> sets;
+	for(const auto& g : m_globs)
+	{
+		for(const auto& t : g.tokens)
+		{
+			if(t.type == TOKEN_CHAR)
+			{
+				sets.push_back(&t.set);
+			}
+		}
+	}
+	std::sort(sets.begin(), sets.end(), [](const std::vector<bool> *lhs, const std::vector<bool> *rhs) { return *lhs < *rhs; });
+	sets.erase(std::unique(sets.begin(), sets.end(), [](const std::vector<bool> *lhs, const std::vector<bool> *rhs) { return *lhs == *rhs; }), sets.end());
+
+	std::map<std::vector<bool>, uint8_t> signatures;
+	uint8_t folded_classes[256] = {};
+	for(unsigned int b = 0; b < 256; ++b)
+	{
+		if(fold(static_cast<uint8_t>(b)) != b)
+		{
+			continue;
+		}
+
+		std::vector<bool> signature(sets.size() + 1);
+		signature[0] = b == '/';
+		for(size_t i = 0; i < sets.size(); ++i)
+		{
+			signature[i + 1] = (*sets[i])[b];
+		}
+
+		auto it = signatures.emplace(std::move(signature), static_cast<uint8_t>(m_representatives.size()));
+		if(it.second)
+		{
+			m_representatives.push_back(static_cast<uint8_t>(b));
+		}
+		folded_classes[b] = it.first->second;
+	}
+	for(unsigned int b = 0; b < 256; ++b)
+	{
+		m_classes[b] = folded_classes[fold(static_cast<uint8_t>(b))];
+	}
+}
+
+db_filter::dfa& db_filter::thread_dfa() const
+{
+	// a thread rarely sees more than one filter, so its DFAs are all dropped once there are a few
+	static thread_local std::unordered_map<uint64_t, dfa> dfas;
+	auto it = dfas.find(m_serial);
+	if(it == dfas.end())
+	{
+		if(dfas.size() >= 16)
+		{
+			dfas.clear();
+		}
+		it = dfas.emplace(m_serial, dfa()).first;
+		reset(it->second);
+	}
+	return it->second;
+}
+
+void db_filter::reset(dfa& d) const
+{
+	d.ids.clear();
+	d.states.clear();
+	d.transitions.clear();
+	d.accepts.clear();
+
+	// the start state is 0, the dead state 1
+	state start;
+	for(uint32_t g = 0; g < m_globs.size(); ++g)
+	{
+		start.emplace_back(g, 0);
+	}
+	close(start);
+	add_state(d, std::move(start));
+	add_state(d, state());
+}
+
+uint32_t db_filter::add_state(dfa& d, state positions) const
+{
+	auto it = d.ids.emplace(std::move(positions), static_cast<uint32_t>(d.states.size()));
+	if(it.second)
+	{
+		d.states.push_back(&it.first->first);
+		d.accepts.push_back(accepts(it.first->first));
+		d.transitions.resize(d.states.size() * m_representatives.size(), DFA_UNKNOWN);
+	}
+	return it.first->second;
+}
+
+bool db_filter::match(std::string_view path) const
+{
+	uint8_t flags = 0;
+	if(!m_globs.empty())
+	{
+		dfa& d = thread_dfa();
+		size_t classes = m_representatives.size();
+		uint32_t id = 0;
+		for(size_t i = 0; i < path.size() && id != 1; ++i)
+		{
+			uint8_t c = m_classes[static_cast<uint8_t>(path[i])];
+			uint32_t next = d.transitions[id * classes + c];
+			if(next == DFA_UNKNOWN)
+			{
+				if(d.states.size() >= DFA_MAX_STATES)
+				{
+					state current = *d.states[id];
+					reset(d);
+					id = add_state(d, std::move(current));
+				}
+				next = add_state(d, step(*d.states[id], m_representatives[c]));
+				d.transitions[id * classes + c] = next;
+			}
+			id = next;
+		}
+		flags = d.accepts[id];
+	}
+
+	if(flags & ACCEPT_EXCLUDE)
+	{
+		return false;
+	}
+
+	bool included = !m_has_includes || (flags & ACCEPT_INCLUDE);
+	for(const auto& r : m_regexes)
+	{
+		if((r.exclude || !included) && std::regex_search(path.begin(), path.end(), r.re))
+		{
+			if(r.exclude)
+			{
+				return false;
+			}
+			included = true;
+		}
+	}
+
+	return included;
+}
+
+void db_unpacker::set_memory_limit(size_t bytes)
+{
+	m_memory_limit = bytes;
+}
+
+void db_unpacker::set_direct_io_threshold(size_t bytes)
+{
+	m_direct_io_threshold = bytes;
+}
+
+void db_unpacker::set_cache_size(size_t bytes)
+{
+	m_cache_size = bytes;
+}
+
+bool db_unpacker::process(const std::string& source_path, const std::string& destination_path, const db_version& version, const std::string& filter)
+{
+	db_filter entries;
+	if(!filter.empty() && !entries.add(filter))
+	{
+		return false;
+	}
+
+	return process(std::vector<std::string>{source_path}, destination_path, version, entries);
+}
+
+bool db_unpacker::process(const std::vector<std::string>& source_paths, const std::string& destination_path, const db_version& version, const db_filter& filter)
+{
+	if(version == DB_VERSION_AUTO)
+	{
+		spdlog::error("unspecified DB format");
+		return false;
+	}
+
+	if(source_paths.empty() || source_paths.front().empty())
+	{
+		spdlog::error("Missing source file path");
+		return false;
+	}
+
+	for(const auto& source_path : source_paths)
+	{
+		if(!xr_file_system::file_exist(source_path))
+		{
+			spdlog::error("File \"{}\" doesn't exist", source_path);
+			return false;
+		}
+	}
+
+	auto path_splitted = xr_file_system::split_path(source_paths.front());
+
+	std::string output_folder = destination_path.empty() ? path_splitted.folder : destination_path;
+
+	xr_file_system& fs = xr_file_system::instance();
+	std::unique_ptr<db_entry_cache> cache;
+	if(m_cache_size != 0)
+	{
+		cache = std::make_unique<db_entry_cache>(m_cache_size);
+	}
+
+	db_overlay overlay;
+	overlay.set_memory_limit(m_memory_limit);
+	overlay.set_cache(cache.get());
+	overlay.set_filter(filter.empty() ? nullptr : &filter);
+	if(!overlay.open(source_paths, version))
+	{
+		return false;
+	}
+
+	if(!fs.create_path(output_folder))
+	{
+		spdlog::error("can't create {}", output_folder);
+		return false;
+	}
+
+	xr_file_system::append_path_separator(output_folder);
+
+	const auto& archives = overlay.archives();
+	std::vector<std::string> folder_paths;
+	for(const auto& archive : archives)
+	{
+		std::vector<uint8_t> userdata;
+		if(archive->read_userdata(userdata))
+		{
+			std::string path = destination_path + "_userdata.ltx";
+			if(archives.size() > 1)
+			{
+				path = destination_path + "_" + xr_file_system::split_path(archive->path()).name + xr_file_system::split_path(archive->path()).extension + "_userdata.ltx";
+			}
+			write_file(fs, path, userdata.data(), userdata.size());
+		}
+
+		for(const auto& folder : archive->folders())
+		{
+			spdlog::debug("{}", folder);
+
+			// a filtered unpack only makes the folders of the files it extracts
+			if(fs.read_only() || !filter.empty())
+			{
+				continue;
+			}
+
+			folder_paths.push_back(folder);
+			spdlog::info("{}", output_folder + folder);
+		}
+	}
+
+	// only the last copy of each path in the set is extracted
+	if(overlay.overridden() != 0)
+	{
+		spdlog::info("{} entries are replaced by later archives and skipped", overlay.overridden());
+	}
+
+	std::vector<db_overlay::entry> files;
+	for(const auto& source : overlay.entries())
+	{
+		const db_file& file = *source.file;
+		spdlog::debug("{}", file.path);
+		spdlog::debug("  offset: {}", file.offset);
+
+		if(source.archive->is_compressed(file))
+		{
+			spdlog::debug("  size (real): {}", file.size_real);
+			spdlog::debug("  size (compressed): {}", file.size_compressed);
+		}
+		else
+		{
+			spdlog::debug("  size: {}", file.size_real);
+		}
+
+		spdlog::debug("  crc: {0:#x}", file.crc);
+
+		if(fs.read_only())
+		{
+			continue;
+		}
+
+		files.push_back(source);
+		folder_paths.emplace_back(split_entry_path(file.path).first);
+	}
+
+	// every folder is made once here, files are then opened relative to their folder's descriptor
+	xr_folder_cache folders;
+	if(!fs.read_only())
+	{
+		folders.create(output_folder, std::move(folder_paths));
+	}
+
+	bool result = extract_files(files, output_folder, folders);
+
+	if(cache != nullptr)
+	{
+		db_entry_cache::stats stats = cache->get_stats();
+		spdlog::info("entry cache: {} hits, {} misses, {} evictions, {} entries of {} bytes kept",
+			stats.hits, stats.misses, stats.evictions, stats.entries, stats.size);
+	}
+
+	return result;
+}
+
+bool db_unpacker::extract_files(const std::vector<db_overlay::entry>& files, const std::string& prefix, const xr_folder_cache& folders)
+{
+	xr_file_system& fs = xr_file_system::instance();
+	std::atomic<std::size_t> file_counter{0};
+	std::atomic<std::size_t> failed{0};
+	std::atomic<uint64_t> bytes_written{0};
+	std::atomic<uint64_t> bytes_copied{0};
+	auto start = std::chrono::steady_clock::now();
+
+	auto done = [&file_counter, &failed, &prefix](const db_file& file, bool ok)
+	{
+		if(ok)
+		{
+			spdlog::info("[{}] {}", ++file_counter, prefix + file.path);
+		}
+		else
+		{
+			spdlog::error("Failed to extract {}", prefix + file.path);
+			++failed;
+		}
+	};
+
+	auto extract = [this, &fs, &bytes_written, &bytes_copied, &prefix, &folders, &done](const db_overlay::entry& source)
+	{
+		size_t copied;
+		bool ok = write_file(fs, prefix, folders, *source.archive, *source.file, m_direct_io_threshold, copied);
+		bytes_written += ok ? source.file->size_real : 0;
+		bytes_copied += copied;
+		done(*source.file, ok);
+	};
+
+	auto report = [&bytes_written, &bytes_copied, &file_counter, &failed, start]()
+	{
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		double seconds = std::max(elapsed.count(), 1e-6);
+		spdlog::info("extracted {} files, {} bytes in {:.2f} s ({:.1f} MB/s), {} bytes copied in kernel",
+			file_counter.load(), bytes_written.load(), elapsed.count(), bytes_written / seconds / (1024 * 1024), bytes_copied.load());
+		if(failed != 0)
+		{
+			spdlog::error("{} files failed to extract", failed.load());
+		}
+		return failed == 0;
+	};
+
+	unsigned int jobs = xr_thread_pool::resolve_threads(m_jobs);
+	if(!fs.io_uring() && (jobs == 1 || files.size() < 2))
+	{
+		std::for_each(files.begin(), files.end(), extract);
+		return report();
+	}
+
+	xr_thread_pool pool(jobs);
+
+	if(fs.io_uring())
+	{
+		// batches fill a ring, their buffers share the memory limit between workers
+		std::vector<std::pair<size_t, size_t>> batches;
+		size_t batch_bytes = m_memory_limit ? std::max<size_t>(m_memory_limit / jobs, 1) : SIZE_MAX;
+		for(size_t first = 0, bytes = 0, i = 0; i < files.size(); ++i)
+		{
+			if(files[i].archive->is_compressed(*files[i].file) || files[i].archive->raw_data(*files[i].file) == nullptr)
+			{
+				bytes += files[i].file->size_real;
+			}
+
+			if(i + 1 == files.size() || i + 1 - first == xr_file_system::URING_ENTRIES / 2 || bytes >= batch_bytes)
+			{
+				batches.emplace_back(first, i + 1);
+				first = i + 1;
+				bytes = 0;
+			}
+		}
+
+		auto extract_batch = [&](size_t batch)
+		{
+			std::vector<xr_write_request> requests;
+			std::vector<const db_file*> written;
+			std::vector<std::vector<uint8_t>> buffers(batches[batch].second - batches[batch].first);
+
+			for(size_t i = batches[batch].first; i < batches[batch].second; ++i)
+			{
+				const db_archive& archive = *files[i].archive;
+				const db_file& file = *files[i].file;
+				const uint8_t *data = archive.is_compressed(file) ? nullptr : archive.raw_data(file);
+				if(data == nullptr)
+				{
+					auto& buffer = buffers[i - batches[batch].first];
+					if(!archive.read(file, buffer))
+					{
+						done(file, false);
+						continue;
+					}
+					data = buffer.data();
+				}
+
+				auto [folder, name] = split_entry_path(file.path);
+				int dirfd = folders.fd(folder);
+				if(dirfd != -1)
+				{
+					requests.push_back({std::string(name), data, file.size_real, 0, dirfd});
+				}
+				else
+				{
+					requests.push_back({prefix + file.path, data, file.size_real, 0});
+				}
+				written.push_back(&file);
+			}
+
+			fs.write_files(requests.data(), requests.size());
+
+			for(size_t i = 0; i < requests.size(); ++i)
+			{
+				if(requests[i].error == 0)
+				{
+					bytes_written += requests[i].size;
+				}
+				done(*written[i], requests[i].error == 0);
+			}
+		};
+
+		spdlog::debug("extracting {} files in {} io_uring batches using {} threads", files.size(), batches.size(), jobs);
+
+		pool.parallel_for(batches.size(), extract_batch);
+		return report();
+	}
+
+	spdlog::debug("extracting {} files using {} threads", files.size(), jobs);
+
+	pool.parallel_for(files.size(), [&extract, &files](size_t i) { extract(files[i]); });
+	return report();
+}
+
+db_packer::~db_packer()
+{
+	delete_elements(m_files);
+}
+
+void db_packer::set_compression_level(unsigned int level)
+{
+	m_compression_level = level;
+}
+
+void db_packer::set_base(const std::string& path)
+{
+	m_base_path = path;
+}
+
+void db_packer::set_cache(const std::string& path)
+{
+	m_cache_path = path;
+}
+
+void db_packer::set_dedup(bool value)
+{
+	m_dedup = value;
+}
+
+bool db_packer::open_base(const db_version& version)
+{
+	if(!xr_file_system::file_exist(m_base_path))
+	{
+		spdlog::warn("Base archive {} doesn't exist, packing every file", m_base_path);
+		return false;
+	}
+
+	if(!m_base.open(m_base_path, version))
+	{
+		spdlog::warn("Can't load base archive {}, packing every file", m_base_path);
+		return false;
+	}
+
+	spdlog::info("Reusing unchanged files from {}", m_base_path);
+	return true;
+}
+
+void db_packer::process(const std::string& source_path, const std::string& destination_path, const db_version& version, const std::string& xdb_ud)
+{
+	if(source_path.empty())
+	{
+		spdlog::error("Missing source directory path");
+		return;
+	}
+
+	if(destination_path.empty())
+	{
+		spdlog::error("Missing destination file path");
+		return;
+	}
+
+	if(!xr_file_system::folder_exist(source_path))
+	{
+		spdlog::error("can't find {}", source_path);
+		return;
+	}
+
+	if(version == DB_VERSION_AUTO)
+	{
+		spdlog::error("Unspecified DB format");
+		return;
+	}
+
+	if(version == DB_VERSION_1114 || version == DB_VERSION_2215 || version == DB_VERSION_2945)
+	{
+		spdlog::error("Unsupported DB format");
+		return;
+	}
+
+	xr_file_system::append_path_separator(m_root);
+
+	auto path_splitted = xr_file_system::split_path(destination_path);
+	std::string extension = path_splitted.extension;
+
+	if(!m_base_path.empty())
+	{
+		std::error_code error;
+		if(std::filesystem::equivalent(m_base_path, destination_path, error))
+		{
+			spdlog::error("The base archive can't be the one being written");
+			return;
+		}
+		open_base(version);
+	}
+
+	// without an explicit cache the base archive's sidecar is used, and one is written for the new archive
+	std::string cache_input = m_cache_path;
+	std::string cache_output = m_cache_path;
+	if(m_cache_path.empty() && !m_base_path.empty())
+	{
+		cache_input = db_cache::path_for(m_base_path);
+		cache_output = db_cache::path_for(destination_path);
+	}
+
+	if(!cache_input.empty() && !m_base_cache.load(cache_input))
+	{
+		spdlog::warn("No usable cache {}, every file is read and checksummed", cache_input);
+	}
+
+	xr_file_system& fs = xr_file_system::instance();
+	m_archive = fs.w_open(destination_path);
+	if(m_archive == nullptr)
+	{
+		spdlog::error("Can't load {}", destination_path);
+		return;
+	}
+
+	if(version == DB_VERSION_XDB && !xdb_ud.empty())
+	{
+		if(xr_reader *reader = fs.r_open(xdb_ud))
+		{
+			m_archive->open_chunk(DB_CHUNK_USERDATA);
+			m_archive->w_raw(reader->data(), reader->size());
+			m_archive->close_chunk();
+			fs.r_close(reader);
+		}
+		else
+		{
+			spdlog::error("can't load {}", xdb_ud);
+		}
+	}
+
+	m_archive->open_chunk(DB_CHUNK_DATA);
+	m_root = source_path;
+	xr_file_system::append_path_separator(m_root);
+	process_folder(m_root);
+	m_archive->close_chunk();
+
+	spdlog::info("files: ");
+	for (const auto& file : m_files)
+	{
+		std::replace(file->path.begin(), file->path.end(), '/', '\\');
+		spdlog::info("  {}", file->path);
+	}
+
+	// folder entries aren't written, unpacking recreates folders from the file paths
+	write_header(*m_archive, {}, m_files, version, m_compression_level);
+
+	fs.w_close(m_archive);
+
+	if(!m_base_path.empty())
+	{
+		spdlog::info("reused {} of {} files ({} bytes) from {}", m_reused_files, m_files.size(), m_reused_bytes, m_base_path);
+	}
+
+	if(m_dedup)
+	{
+		spdlog::info("{} files are duplicates, {} bytes saved", m_dedup_files, m_dedup_bytes);
+	}
+
+	if(!cache_output.empty())
+	{
+		spdlog::info("took {} of {} checksums from the cache", m_cached_files, m_files.size());
+
+		if(!fs.read_only() && !m_cache.save(cache_output))
+		{
+			spdlog::error("Can't write {}", cache_output);
+		}
+	}
+}
+
+void db_packer::process_folder(const std::string& path)
+{
+	auto root_path = std::filesystem::path(path);
+
+	std::vector<std::filesystem::directory_entry> folders;
+	std::vector<std::filesystem::directory_entry> files;
+
+	for (auto& entry : std::filesystem::recursive_directory_iterator(path))
+	{
+		if(entry.is_directory())
+		{
+			folders.emplace_back(entry);
+		}
+		else if(entry.is_regular_file())
+		{
+			files.emplace_back(entry);
+		}
+	}
+
+	std::sort(folders.begin(), folders.end(), [] (std::filesystem::directory_entry lhs, std::filesystem::directory_entry rhs)
+	{
+		return lhs.path() < rhs.path();
+	});
+
+	for(auto folder : folders)
+	{
+		auto entry_path = std::filesystem::path(folder);
+		std::string relative_path = std::filesystem::relative(entry_path, root_path);
+		m_folders.push_back(relative_path);
+	}
+
+	std::sort(files.begin(), files.end(), [] (std::filesystem::directory_entry lhs, std::filesystem::directory_entry rhs)
+	{
+		return lhs.path() < rhs.path();
+	});
+
+	std::vector<std::string> relative_paths;
+	relative_paths.reserve(files.size());
+	for(auto file : files)
+	{
+		auto entry_path = std::filesystem::path(file);
+		relative_paths.push_back(std::filesystem::relative(entry_path, root_path));
+	}
+
+	process_files(relative_paths);
+}
+
+void db_packer::process_file(const std::string& path)
+{
+	std::unique_ptr<packed_file> file(read_file(path));
+	if(file)
+	{
+		pack_file(*file);
+		write_file(*file);
+	}
+}
+
+void db_packer::process_files(const std::vector<std::string>& paths)
+{
+	unsigned int jobs = xr_thread_pool::resolve_threads(m_jobs);
+	if(jobs == 1 || paths.size() < 2)
+	{
+		std::for_each(paths.begin(), paths.end(), [this](const std::string& path) { process_file(path); });
+		return;
+	}
+
+	spdlog::debug("packing {} files using {} threads", paths.size(), jobs);
+
+	// Files are read and packed out of order, but appended strictly in the order of paths, so the
+	// archive is identical to the one produced by the serial path. The window bounds the number of
+	// mapped source files.
+	using packed_future = std::future<std::unique_ptr<packed_file>>;
+	const size_t window = 4 * jobs;
+
+	xr_thread_pool readers(jobs);
+	xr_thread_pool workers(jobs);
+	std::deque<std::future<packed_future>> pending;
+
+	auto write_front = [this, &pending]()
+	{
+		std::unique_ptr<packed_file> file = pending.front().get().get();
+		pending.pop_front();
+		if(file)
+		{
+			write_file(*file);
+		}
+	};
+
+	for(const auto& path : paths)
+	{
+		if(pending.size() >= window)
+		{
+			write_front();
+		}
+
+		pending.push_back(readers.submit([this, &workers, path]()
+		{
+			std::unique_ptr<packed_file> file(read_file(path));
+			return workers.submit([this, file = std::move(file)]() mutable
+			{
+				if(file)
+				{
+					pack_file(*file);
+				}
+				return std::move(file);
+			});
+		}));
+	}
+
+	while(!pending.empty())
+	{
+		write_front();
+	}
+}
+
+db_packer::packed_file::~packed_file()
+{
+	xr_file_system::r_close(reader);
+	free(data_compressed);
+}
+
+db_packer::packed_file* db_packer::read_file(const std::string& path) const
+{
+	struct stat st {};
+	if(stat((m_root + path).c_str(), &st) == -1)
+	{
+		spdlog::error("stat failed for file \"{}\": {} (errno={}) ", m_root + path, strerror(errno), errno);
+		return nullptr;
+	}
+
+	uint64_t mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+	auto size = static_cast<uint64_t>(st.st_size);
+
+	auto inode = static_cast<uint64_t>(st.st_ino);
+
+	const db_cache::entry *cached = m_base_cache.find(path);
+	if(cached && (cached->size != size || cached->mtime != mtime || cached->inode != inode))
+	{
+		cached = nullptr;
+	}
+
+	// unchanged since the base archive was built: its bytes are copied over without reading the source
+	if(cached && m_base.is_open())
+	{
+		const db_file *entry = m_base.find(path);
+		if(entry && entry->offset == cached->offset && entry->size_real == size &&
+			entry->size_compressed == cached->size_compressed && entry->crc == cached->crc)
+		{
+			auto file = new packed_file;
+			file->path = path;
+			file->size = entry->size_real;
+			file->size_compressed = static_cast<uint32_t>(entry->size_compressed);
+			file->crc = entry->crc;
+			file->mtime = mtime;
+			file->inode = inode;
+			file->base = entry;
+			return file;
+		}
+	}
+
+	xr_reader *reader = xr_file_system::r_open(m_root + path);
+	if(reader == nullptr)
+	{
+		return nullptr;
+	}
+
+	auto file = new packed_file;
+	file->path = path;
+	file->reader = reader;
+	file->size = reader->size();
+	file->mtime = mtime;
+	file->inode = inode;
+
+	// the checksum of stored data only depends on the source, compressed data is redone anyway
+	if(cached && !compress_files)
+	{
+		file->crc = cached->crc;
+		file->crc_cached = true;
+	}
+
+	// fault the mapping in here, so the checksum stage doesn't stall on disk reads
+	const auto *data = static_cast<const volatile uint8_t*>(reader->data());
+	auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	for(size_t offset = 0; offset < file->size; offset += page_size)
+	{
+		(void)data[offset];
+	}
+
+	return file;
+}
+
+// the first path of the group, m_groups_mutex must be held
+std::string db_packer::group(std::string path) const
+{
+	for(auto it = m_groups.find(path); it != m_groups.end(); it = m_groups.find(path))
+	{
+		path = it->second;
+	}
+	return path;
+}
+
+void db_packer::hash_contents(packed_file& file, const uint8_t *data) const
+{
+	if(data == nullptr)
+	{
+		return;
+	}
+
+	file.hash = xr_hash64(data, file.size);
+	file.hashed = true;
+
+	// the hash only picks candidates, files join a group after the contents compare equal
+	std::vector<std::string> candidates;
+	{
+		std::lock_guard<std::mutex> lock(m_groups_mutex);
+		auto range = m_hashed.equal_range(file.hash);
+		for(auto it = range.first; it != range.second; ++it)
+		{
+			candidates.push_back(it->second);
+		}
+		m_hashed.emplace(file.hash, file.path);
+	}
+
+	for(const auto& candidate : candidates)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_groups_mutex);
+			if(group(candidate) == group(file.path))
+			{
+				continue;
+			}
+		}
+
+		// an entry reused from the base archive has an unchanged source, so that is read as well
+		xr_reader *reader = xr_file_system::r_open(m_root + candidate);
+		if(reader == nullptr)
+		{
+			continue;
+		}
+
+		bool same = reader->size() == file.size && std::memcmp(reader->data(), data, file.size) == 0;
+		xr_file_system::r_close(reader);
+
+		if(same)
+		{
+			std::lock_guard<std::mutex> lock(m_groups_mutex);
+			std::string from = group(file.path), to = group(candidate);
+			if(from != to)
+			{
+				m_groups[from] = to;
+			}
+		}
+	}
+}
+
+const db_tools::db_file* db_packer::find_duplicate(const packed_file& file) const
+{
+	if(!m_dedup || !file.hashed)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(m_groups_mutex);
+	std::string own = group(file.path);
+
+	auto range = m_blobs.equal_range(file.hash);
+	for(auto it = range.first; it != range.second; ++it)
+	{
+		const db_file *entry = it->second.entry;
+		if(entry->size_real == file.size && entry->crc == file.crc && group(it->second.path) == own)
+		{
+			return entry;
+		}
+	}
+
+	return nullptr;
+}
+
+void db_packer::pack_file(packed_file& file) const
+{
+	if(file.base)
+	{
+		// reused entries are hashed from the base archive, so later copies of them are shared too
+		if(m_dedup && !m_base.is_compressed(*file.base))
+		{
+			hash_contents(file, m_base.raw_data(*file.base));
+		}
+		return;
+	}
+
+	const uint8_t *data = static_cast<const uint8_t*>(file.reader->data());
+
+	if constexpr(compress_files)
+	{
+		xr_lzhuf::compress(file.data_compressed, file.size_compressed, data, static_cast<uint32_t>(file.size), m_compression_level);
+		spdlog::info("{}->{} {}", file.size, file.size_compressed, file.path);
+
+		file.crc = crc32(file.data_compressed, file.size_compressed);
+	}
+	else if(!file.crc_cached)
+	{
+		file.crc = crc32(data, file.size);
+	}
+
+	if(m_dedup)
+	{
+		hash_contents(file, data);
+	}
+}
+
+void db_packer::write_file(const packed_file& file)
+{
+	size_t offset = m_archive->tell();
+	size_t size_compressed = file.size;
+
+	const db_file *duplicate = find_duplicate(file);
+	if(duplicate)
+	{
+		offset = duplicate->offset;
+		size_compressed = duplicate->size_compressed;
+
+		++m_dedup_files;
+		m_dedup_bytes += size_compressed;
+	}
+	else if(file.base)
+	{
+		size_compressed = file.base->size_compressed;
+
+		// entries the base archive already shared are copied once
+		auto copied = m_dedup ? m_base_offsets.find(file.base->offset) : m_base_offsets.end();
+		if(copied != m_base_offsets.end())
+		{
+			offset = copied->second;
+
+			++m_dedup_files;
+			m_dedup_bytes += size_compressed;
+		}
+		else
+		{
+			auto archive = dynamic_cast<xr_file_writer_posix*>(m_archive);
+			if(!archive || m_base.fd() == -1 || !archive->w_copy(m_base.fd(), file.base->offset, size_compressed))
+			{
+				const uint8_t *data = m_base.raw_data(*file.base);
+				xr_assert(data != nullptr);
+				m_archive->w_raw(data, size_compressed);
+			}
+
+			if(m_dedup)
+			{
+				m_base_offsets.emplace(file.base->offset, offset);
+			}
+		}
+
+		++m_reused_files;
+		m_reused_bytes += size_compressed;
+	}
+	else if(file.data_compressed)
+	{
+		size_compressed = file.size_compressed;
+		m_archive->w_raw(file.data_compressed, size_compressed);
+	}
+	else
+	{
+		m_archive->w_raw(file.reader->data(), file.size);
+	}
+
+	std::string path_lowercase = file.path;
+	std::transform(path_lowercase.begin(), path_lowercase.end(), path_lowercase.begin(), [](unsigned char c) { return std::tolower(c); });
+
+	auto entry = new db_file;
+	entry->path = path_lowercase;
+	entry->crc = file.crc;
+	entry->offset = offset;
+	entry->size_real = file.size;
+	entry->size_compressed = size_compressed;
+	entry->compressed = size_compressed != file.size;
+	m_files.push_back(entry);
+
+	if(file.crc_cached)
+	{
+		++m_cached_files;
+	}
+
+	if(m_dedup && file.hashed && !duplicate)
+	{
+		m_blobs.emplace(file.hash, blob{entry, file.path});
+	}
+
+	if(!m_cache_path.empty() || !m_base_path.empty())
+	{
+		m_cache.add(file.path, {file.size, file.mtime, file.inode, offset, static_cast<uint32_t>(size_compressed), file.crc});
+	}
+}
+
+void db_updater::set_compression_level(unsigned int level)
+{
+	m_compression_level = level;
+}
+
+bool db_updater::check_version(const db_version& version)
+{
+	if(version == DB_VERSION_AUTO)
+	{
+		spdlog::error("Unspecified DB format");
+		return false;
+	}
+
+	if(version == DB_VERSION_1114 || version == DB_VERSION_2215 || version == DB_VERSION_2945)
+	{
+		spdlog::error("Unsupported DB format");
+		return false;
+	}
+
+	return true;
+}
+
+bool db_updater::read_chunks(const std::string& path, std::vector<chunk>& chunks, size_t& file_size)
+{
+	xr_file_reader_posix file;
+	if(!file.open(path))
+	{
+		return false;
+	}
+
+	file_size = file.size();
+	for(size_t offset = 0; offset + 8 <= file_size;)
+	{
+		uint32_t header[2];
+		if(!file.r_raw(offset, header, sizeof(header)))
+		{
+			return false;
+		}
+
+		chunks.push_back({header[0], offset, header[1]});
+		offset += 8 + header[1];
+	}
+
+	return true;
+}
+
+void db_updater::process(const std::string& source_path, const std::string& archive_path, const db_version& version)
+{
+	if(source_path.empty())
+	{
+		spdlog::error("Missing source directory path");
+		return;
+	}
+
+	if(archive_path.empty())
+	{
+		spdlog::error("Missing archive path");
+		return;
+	}
+
+	if(!xr_file_system::folder_exist(source_path))
+	{
+		spdlog::error("can't find {}", source_path);
+		return;
+	}
+
+	if(!check_version(version))
+	{
+		return;
+	}
 
-		if(mask.length() > 0 && offset != 0 && path.find(mask) == std::string::npos)
-		{
-			continue;
-		}
+	// new entries can only be appended to the data chunk if nothing but the header follows it
+	std::vector<chunk> chunks;
+	size_t file_size = 0;
+	if(!read_chunks(archive_path, chunks, file_size))
+	{
+		spdlog::error("Can't load {}", archive_path);
+		return;
+	}
+
+	if(chunks.size() < 2 || chunks.back().offset + 8 + chunks.back().size != file_size ||
+		(chunks.back().id & ~CHUNK_COMPRESSED) != DB_CHUNK_HEADER || chunks[chunks.size() - 2].id != DB_CHUNK_DATA)
+	{
+		spdlog::error("{} doesn't end with the data and header chunks, run --compact on it first", archive_path);
+		return;
+	}
+
+	const chunk data_chunk = chunks[chunks.size() - 2];
 
-		spdlog::debug("{}", name);
-		spdlog::debug("  offset: {}", offset);
+	db_archive archive;
+	if(!archive.open(archive_path, version))
+	{
+		spdlog::error("Can't load {}", archive_path);
+		return;
+	}
+
+	std::vector<db_file> entries(archive.files().begin(), archive.files().end());
 
-		if(size_real != size_compressed)
+	std::string root = source_path;
+	xr_file_system::append_path_separator(root);
+
+	std::vector<std::string> paths;
+	for(auto& entry : std::filesystem::recursive_directory_iterator(root))
+	{
+		if(entry.is_regular_file())
 		{
-			spdlog::debug("  size (real): {}", size_real);
-			spdlog::debug("  size (compressed): {}", size_compressed);
+			paths.push_back(std::filesystem::relative(entry.path(), root).generic_string());
 		}
-		else
+	}
+	std::sort(paths.begin(), paths.end());
+
+	xr_file_system& fs = xr_file_system::instance();
+	xr_writer *w = fs.w_open_existing(archive_path);
+	if(w == nullptr)
+	{
+		spdlog::error("Can't open {} for writing: {} (errno={})", archive_path, strerror(errno), errno);
+		return;
+	}
+
+	if(!fs.read_only())
+	{
+		w->seek(file_size);
+	}
+
+	size_t added = 0, replaced = 0, unchanged = 0;
+	uint64_t appended = 0;
+	for(const auto& path : paths)
+	{
+		xr_reader *reader = xr_file_system::r_open(root + path);
+		if(reader == nullptr)
 		{
-			spdlog::debug("  size: {}", size_real);
+			spdlog::error("Can't load {}", root + path);
+			continue;
 		}
 
-		spdlog::debug("  crc: {0:#x}", crc);
+		size_t size = reader->size();
+		uint32_t crc = crc32(reader->data(), size);
+		const db_file *existing = archive.find(path);
 
-		if(fs.read_only())
+		if(existing && existing->size_real == size && existing->size_compressed == size && existing->crc == crc)
 		{
+			++unchanged;
+			xr_file_system::r_close(reader);
 			continue;
 		}
 
-		if(offset == 0)
+		size_t offset = w->tell();
+		if(offset + size > UINT32_MAX)
+		{
+			spdlog::error("{} would grow past 4 GB, {} and the rest are left out", archive_path, path);
+			xr_file_system::r_close(reader);
+			break;
+		}
+
+		w->w_raw(reader->data(), size);
+		xr_file_system::r_close(reader);
+
+		std::string path_lowercase = path;
+		std::transform(path_lowercase.begin(), path_lowercase.end(), path_lowercase.begin(), [](unsigned char c) { return std::tolower(c); });
+		db_file entry {path_lowercase, offset, size, size, crc, false};
+
+		if(existing)
 		{
-			fs.create_path(path);
-			spdlog::info("{}", path);
+			entries[existing - archive.files().data()] = std::move(entry);
+			++replaced;
 		}
 		else
 		{
-			write_file(fs, path, data + offset, size_real, size_compressed);
-			static std::size_t file_counter = 0;
-			spdlog::info("[{}] {}", ++file_counter, path);
+			entries.push_back(std::move(entry));
+			++added;
 		}
+		appended += size;
 	}
-}
 
-db_packer::~db_packer()
-{
-	delete_elements(m_files);
+	if(added == 0 && replaced == 0)
+	{
+		spdlog::info("{} is up to date", archive_path);
+		fs.w_close(w);
+		return;
+	}
+
+	std::vector<db_file*> files;
+	files.reserve(entries.size());
+	for(auto& entry : entries)
+	{
+		files.push_back(&entry);
+	}
+
+	spdlog::info("added {}, replaced {}, kept {} files, {} bytes appended", added, replaced, unchanged, appended);
+
+	if(fs.read_only())
+	{
+		fs.w_close(w);
+		return;
+	}
+
+	size_t header_offset = w->tell();
+	write_header(*w, archive.folders(), files, version, m_compression_level);
+
+	// the new header has to be on the disk before the data chunk is grown over the old one
+	auto file = dynamic_cast<xr_file_writer_posix*>(w);
+	if(file && !file->sync())
+	{
+		spdlog::error("{} is left unchanged", archive_path);
+		fs.w_close(w);
+		return;
+	}
+
+	auto data_size = static_cast<uint32_t>(header_offset - data_chunk.offset - 8);
+	w->w_raw_at(data_chunk.offset + 4, &data_size, sizeof(data_size));
+	if(file)
+	{
+		file->sync();
+	}
+	fs.w_close(w);
+
+	uint64_t live = 0;
+	std::unordered_map<size_t, size_t> blobs;
+	for(const auto& entry : entries)
+	{
+		blobs.emplace(entry.offset, entry.size_compressed);
+	}
+	for(const auto& blob : blobs)
+	{
+		live += blob.second;
+	}
+	spdlog::info("{} bytes of the data chunk are unused, --compact reclaims them", data_size - live);
 }
 
-void db_packer::process(const std::string& source_path, const std::string& destination_path, const db_version& version, const std::string& xdb_ud)
+void db_updater::compact(const std::string& archive_path, const db_version& version)
 {
-	if(source_path.empty())
+	if(archive_path.empty())
 	{
-		spdlog::error("Missing source directory path");
+		spdlog::error("Missing archive path");
 		return;
 	}
 
-	if(destination_path.empty())
+	if(!check_version(version))
 	{
-		spdlog::error("Missing destination file path");
 		return;
 	}
 
-	if(!xr_file_system::folder_exist(source_path))
+	db_archive archive;
+	if(!archive.open(archive_path, version))
 	{
-		spdlog::error("can't find {}", source_path);
+		spdlog::error("Can't load {}", archive_path);
 		return;
 	}
 
-	if(version == DB_VERSION_AUTO)
+	xr_file_system& fs = xr_file_system::instance();
+	std::string temp_path = archive_path + ".tmp";
+	xr_writer *w = fs.w_open(temp_path);
+	if(w == nullptr)
 	{
-		spdlog::error("Unspecified DB format");
+		spdlog::error("Can't load {}", temp_path);
 		return;
 	}
 
-	if(version == DB_VERSION_1114 || version == DB_VERSION_2215 || version == DB_VERSION_2945)
+	std::vector<uint8_t> userdata;
+	if(archive.read_userdata(userdata))
 	{
-		spdlog::error("Unsupported DB format");
-		return;
+		w->open_chunk(DB_CHUNK_USERDATA);
+		w->w_raw(userdata.data(), userdata.size());
+		w->close_chunk();
 	}
 
-	xr_file_system::append_path_separator(m_root);
+	// entries are copied in the order they lie in the archive, so it is read sequentially
+	std::vector<db_file> entries(archive.files().begin(), archive.files().end());
+	std::vector<size_t> order(entries.size());
+	for(size_t i = 0; i != order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&entries](size_t lhs, size_t rhs) { return entries[lhs].offset < entries[rhs].offset; });
 
-	auto path_splitted = xr_file_system::split_path(destination_path);
-	std::string extension = path_splitted.extension;
+	auto file = dynamic_cast<xr_file_writer_posix*>(w);
+	std::unordered_map<size_t, size_t> offsets; // old -> new, entries sharing data keep sharing it
+	w->open_chunk(DB_CHUNK_DATA);
+	for(auto index : order)
+	{
+		db_file& entry = entries[index];
+		auto copied = offsets.emplace(entry.offset, w->tell());
+		if(copied.second)
+		{
+			if(!file || archive.fd() == -1 || !file->w_copy(archive.fd(), entry.offset, entry.size_compressed))
+			{
+				// a truncated archive has entries past its end
+				const uint8_t *data = archive.raw_data(entry);
+				if(data == nullptr)
+				{
+					spdlog::error("Entry \"{}\" lies outside of {}", entry.path, archive_path);
+					fs.w_close(w);
+					std::remove(temp_path.c_str());
+					spdlog::error("{} is left unchanged", archive_path);
+					return;
+				}
+				w->w_raw(data, entry.size_compressed);
+			}
+		}
+		entry.offset = copied.first->second;
+	}
+	w->close_chunk();
 
-	xr_file_system& fs = xr_file_system::instance();
-	m_archive = fs.w_open(destination_path);
-	if(m_archive == nullptr)
+	std::vector<db_file*> files;
+	files.reserve(entries.size());
+	for(auto& entry : entries)
 	{
-		spdlog::error("Can't load {}", destination_path);
+		files.push_back(&entry);
+	}
+	write_header(*w, archive.folders(), files, version, m_compression_level);
+
+	size_t size = w->tell();
+	if(file && !file->sync())
+	{
+		fs.w_close(w);
+		std::remove(temp_path.c_str());
+		spdlog::error("{} is left unchanged", archive_path);
 		return;
 	}
+	fs.w_close(w);
+	archive.close();
 
-	if(version == DB_VERSION_XDB && !xdb_ud.empty())
+	if(fs.read_only())
 	{
-		if(xr_reader *reader = fs.r_open(xdb_ud))
+		spdlog::info("{} would shrink from {} to {} bytes", archive_path, std::filesystem::file_size(archive_path), size);
+		return;
+	}
+
+	auto old_size = std::filesystem::file_size(archive_path);
+	if(std::rename(temp_path.c_str(), archive_path.c_str()) == -1)
+	{
+		spdlog::error("Can't rename {} to {}: {} (errno={})", temp_path, archive_path, strerror(errno), errno);
+		return;
+	}
+
+	spdlog::info("{} shrunk from {} to {} bytes", archive_path, old_size, size);
+}
+
+namespace
+{
+	// SplitMix64: a tiny PRNG whose output is the same everywhere, unlike std:: distributions
+	struct splitmix64
+	{
+		explicit splitmix64(uint64_t seed): state(seed) {}
+
+		uint64_t operator()()
 		{
-			m_archive->open_chunk(DB_CHUNK_USERDATA);
-			m_archive->w_raw(reader->data(), reader->size());
-			m_archive->close_chunk();
-			fs.r_close(reader);
+			uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			return z ^ (z >> 31);
 		}
-		else
+
+		uint64_t state;
+	};
+
+	enum
+	{
+		GENERATOR_STREAM_SIZE = 1,
+		GENERATOR_STREAM_DATA = 2,
+
+		GENERATOR_BLOCK_SIZE = 64,
+	};
+
+	splitmix64 generator_stream(uint64_t seed, uint64_t index, uint64_t stream)
+	{
+		splitmix64 mix(seed ^ (index * 0xd1b54a32d192ed03ull) ^ (stream << 56));
+		return splitmix64(mix());
+	}
+
+	// e^x for x in [0, 1) as 2.30 fixed point, summed as a Taylor series in integers
+	uint64_t fixed_exp(uint64_t x)
+	{
+		uint64_t sum = 1ull << 30, term = 1ull << 30;
+		for(uint64_t n = 1; term != 0; ++n)
 		{
-			spdlog::error("can't load {}", xdb_ud);
+			term = (term * x >> 30) / n;
+			sum += term;
 		}
+		return sum;
 	}
 
-	m_archive->open_chunk(DB_CHUNK_DATA);
-	m_root = source_path;
-	xr_file_system::append_path_separator(m_root);
-	process_folder(m_root);
-	m_archive->close_chunk();
+	// text the compressible blocks are cut from
+	const std::string& generator_vocabulary()
+	{
+		static const std::string vocabulary = []()
+		{
+			static const char *words[] = {"[section]", "visual", " = ", "meshes\\dynamics\\", "textures\\", ".ogf", ".dds", "\r\n", "; ", "0.5, ", "true", "inv_weight", "cost", "sound"};
+			splitmix64 random(0);
+			std::string text;
+			while(text.size() < 4096 + GENERATOR_BLOCK_SIZE)
+			{
+				text += words[random() % xr_dim(words)];
+			}
+			return text;
+		}();
+		return vocabulary;
+	}
+}
 
-	auto w = new xr_memory_writer;
+void db_generator::set_settings(const settings& value)
+{
+	m_settings = value;
+	m_settings.fan_out = std::max(m_settings.fan_out, 1u);
+	m_settings.files_per_folder = std::max(m_settings.files_per_folder, 1u);
+}
 
-//	spdlog::info("folders: ");
-//	for (const auto& folder : m_folders)
-//	{
-//		w->w_size_u16(folder.size() + 16);
-//		w->w_u32(0);
-//		w->w_u32(0);
-//		w->w_u32(0);
-//		w->w_raw(folder.data(), folder.size());
-//		spdlog::info("  {}", folder);
-//		w->w_u32(0);
-//	}
+std::string db_generator::entry_path(uint64_t index) const
+{
+	static const char *extensions[] = {".dds", ".ogf", ".ltx", ".ogg", ".script"};
 
-	spdlog::info("files: ");
-	for (const auto& file : m_files)
+	// the leaf folder number written in base fan_out, one digit per level
+	uint64_t leaf = index / m_settings.files_per_folder;
+	std::vector<uint64_t> digits(m_settings.depth);
+	for(unsigned int level = m_settings.depth; level-- > 0;)
 	{
-		std::replace(file->path.begin(), file->path.end(), '/', '\\');
-		w->w_size_u16(file->path.size() + 16);
-		w->w_size_u32(file->size_real);
-		w->w_size_u32(file->size_compressed);
-		w->w_u32(file->crc);
-		w->w_raw(file->path.data(), file->path.size());
-		spdlog::info("  {}", file->path);
-		w->w_size_u32(file->offset);
+		digits[level] = level == 0 ? leaf : leaf % m_settings.fan_out;
+		leaf /= m_settings.fan_out;
 	}
 
-	uint8_t *data = nullptr;
-	uint32_t size = 0;
-	xr_lzhuf::compress(data, size, w->data(), w->tell());
-	delete w;
+	std::string path;
+	for(unsigned int level = 0; level < m_settings.depth; ++level)
+	{
+		path += fmt::format("level{}_{}/", level, digits[level]);
+	}
+	path += fmt::format("file_{:07}{}", index, extensions[index % xr_dim(extensions)]);
+	return path;
+}
 
-	if(version == DB_VERSION_2947RU)
+uint64_t db_generator::entry_size(uint64_t index) const
+{
+	if(m_settings.size_sigma <= 0)
 	{
-		xr_scrambler scrambler(xr_scrambler::CC_RU);
-		scrambler.encrypt(data, data, size);
+		return std::min(m_settings.size_median, m_settings.size_max);
 	}
-	else if(version == DB_VERSION_2947WW)
+
+	// All in 16.16 fixed point, libm results differ between versions. The normal deviate is the sum of
+	// twelve uniforms less 6 (Irwin-Hall), which cuts the tails at 6 sigma and is otherwise close.
+	splitmix64 random = generator_stream(m_settings.seed, index, GENERATOR_STREAM_SIZE);
+	int64_t normal = -(int64_t(6) << 16);
+	for(int i = 0; i < 12; ++i)
 	{
-		xr_scrambler scrambler(xr_scrambler::CC_WW);
-		scrambler.encrypt(data, data, size);
+		normal += static_cast<int64_t>(random() >> 48);
 	}
 
-	m_archive->open_chunk(DB_CHUNK_HEADER | CHUNK_COMPRESSED);
-	m_archive->w_raw(data, size);
-	m_archive->close_chunk();
+	// median * e^(sigma * normal) = median * 2^(sigma * normal * log2(e)), the fraction taken as e^(f * ln 2)
+	auto sigma = static_cast<int64_t>(std::min(m_settings.size_sigma, 64.0) * 65536 + 0.5);
+	int64_t power = (sigma * normal >> 16) * 94548 >> 16; // log2(e) = 94548 / 65536
+	int64_t whole = power >> 16;
+	uint64_t fraction = fixed_exp(static_cast<uint64_t>(power & 0xffff) * 2977044472ull >> 16 >> 2); // ln 2 = 2977044472 / 2^32
 
-	delete data;
-	fs.w_close(m_archive);
+	unsigned __int128 size = static_cast<unsigned __int128>(m_settings.size_median) * fraction;
+	if(whole >= 0)
+	{
+		if(whole >= 64 || size >> (127 - whole) != 0)
+		{
+			return m_settings.size_max;
+		}
+		size <<= whole;
+	}
+	else
+	{
+		size = whole > -128 ? size >> -whole : 0;
+	}
+	size >>= 30;
+	return size > m_settings.size_max ? m_settings.size_max : static_cast<uint64_t>(size);
 }
 
-void db_packer::process_folder(const std::string& path)
+void db_generator::entry_data(uint64_t index, std::vector<uint8_t>& data) const
 {
-	auto root_path = std::filesystem::path(path);
-
-	std::vector<std::filesystem::directory_entry> folders;
-	std::vector<std::filesystem::directory_entry> files;
+	const std::string& vocabulary = generator_vocabulary();
+	splitmix64 random = generator_stream(m_settings.seed, index, GENERATOR_STREAM_DATA);
+	auto threshold = static_cast<uint64_t>(m_settings.compressibility * 65536);
 
-	for (auto& entry : std::filesystem::recursive_directory_iterator(path))
+	data.resize(entry_size(index));
+	for(size_t pos = 0; pos < data.size(); pos += GENERATOR_BLOCK_SIZE)
 	{
-		if(entry.is_directory())
+		size_t length = std::min<size_t>(GENERATOR_BLOCK_SIZE, data.size() - pos);
+		uint64_t choice = random();
+
+		if((choice & 0xffff) < threshold)
 		{
-			folders.emplace_back(entry);
+			std::memcpy(&data[pos], vocabulary.data() + (choice >> 16) % 4096, length);
+			continue;
 		}
-		else if(entry.is_regular_file())
+
+		for(size_t i = 0; i < length; i += sizeof(uint64_t))
 		{
-			files.emplace_back(entry);
+			uint64_t noise = random();
+			std::memcpy(&data[pos + i], &noise, std::min(sizeof(noise), length - i));
 		}
 	}
+}
 
-	std::sort(folders.begin(), folders.end(), [] (std::filesystem::directory_entry lhs, std::filesystem::directory_entry rhs)
-	{
-		return lhs.path() < rhs.path();
-	});
+void db_generator::make_blob(uint64_t index, const db_version& version, blob& result) const
+{
+	entry_data(index, result.data);
+	result.crc = crc32(result.data.data(), result.data.size());
+	result.packed.clear();
 
-	for(auto folder : folders)
+	if(!m_settings.compress || result.data.empty())
 	{
-		auto entry_path = std::filesystem::path(folder);
-		std::string relative_path = std::filesystem::relative(entry_path, root_path);
-		m_folders.push_back(relative_path);
+		return;
 	}
 
-	std::sort(files.begin(), files.end(), [] (std::filesystem::directory_entry lhs, std::filesystem::directory_entry rhs)
+	if(version == DB_VERSION_1114)
 	{
-		return lhs.path() < rhs.path();
-	});
+		uint8_t *code = nullptr;
+		uint32_t code_size = 0;
+		xr_lzhuf::compress(code, code_size, result.data.data(), static_cast<uint32_t>(result.data.size()));
+		if(code_size < result.data.size())
+		{
+			result.packed.assign(code, code + code_size);
+		}
+		free(code);
+		return;
+	}
 
-	for(auto file : files)
+	thread_local std::vector<uint8_t> work(LZO1X_1_MEM_COMPRESS);
+	result.packed.resize(result.data.size() + result.data.size() / 16 + 64 + 3);
+	lzo_uint packed_size = result.packed.size();
+	if(lzo1x_1_compress(result.data.data(), result.data.size(), result.packed.data(), &packed_size, work.data()) == LZO_E_OK && packed_size < result.data.size())
 	{
-		auto entry_path = std::filesystem::path(file);
-		std::string relative_path = std::filesystem::relative(entry_path, root_path);
-		process_file(relative_path);
+		result.packed.resize(packed_size);
+	}
+	else
+	{
+		result.packed.clear();
 	}
 }
 
-void db_packer::process_file(const std::string& path)
+bool db_generator::write_volume(const std::string& path, const db_version& version, uint64_t first, uint64_t last, uint64_t& written)
 {
-	constexpr bool compress_files = false;
-
-	if constexpr(compress_files)
+	xr_file_system& fs = xr_file_system::instance();
+	xr_writer *w = fs.w_open(path);
+	if(w == nullptr)
 	{
-		xr_file_system& fs = xr_file_system::instance();
-		auto reader = fs.r_open(m_root + path);
-		if(reader)
-		{
-			const uint8_t *data = static_cast<const uint8_t*>(reader->data());
-			size_t offset = m_archive->tell();
-			size_t size = reader->size();
+		spdlog::error("Can't write {}: {} (errno={})", path, strerror(errno), errno);
+		return false;
+	}
 
-			uint8_t *data_compressed = nullptr;
-			uint32_t size_compressed = 0;
-			xr_lzhuf::compress(data_compressed, size_compressed, data, size);
-			spdlog::info("{}->{} {}", size, size_compressed, path);
+	std::vector<db_file> entries;
+	entries.reserve(last - first);
 
-			uint32_t crc = crc32(data_compressed, size_compressed);
-			m_archive->w_raw(data_compressed, size_compressed);
-			fs.r_close(reader);
+	xr_thread_pool pool(m_jobs);
+	const size_t batch_size = 8 * pool.size();
+	std::vector<blob> batch(batch_size);
+
+	w->open_chunk(DB_CHUNK_DATA);
+	for(uint64_t begin = first; begin < last; begin += batch_size)
+	{
+		size_t count = static_cast<size_t>(std::min<uint64_t>(batch_size, last - begin));
+		pool.parallel_for(count, [this, &batch, &version, begin](size_t i) { make_blob(begin + i, version, batch[i]); });
 
-			std::string path_lowercase = path;
-			std::transform(path_lowercase.begin(), path_lowercase.end(), path_lowercase.begin(), [](unsigned char c) { return std::tolower(c); });
+		for(size_t i = 0; i < count; ++i)
+		{
+			const blob& b = batch[i];
+			const auto& stored = b.packed.empty() ? b.data : b.packed;
 
-			db_file *file = new db_file;
-			file->path = path_lowercase;
-			file->crc = crc;
-			file->offset = offset;
-			file->size_real = size;
-			file->size_compressed = size_compressed;
-			m_files.push_back(file);
+			entries.push_back({entry_path(begin + i), w->tell(), b.data.size(), stored.size(), b.crc, !b.packed.empty()});
+			w->w_raw(stored.data(), stored.size());
+			written += stored.size();
 		}
 	}
-	else
+	w->close_chunk();
+
+	std::vector<std::string> folders;
+	for(const auto& entry : entries)
 	{
-		xr_file_system& fs = xr_file_system::instance();
-		auto reader = fs.r_open(m_root + path);
-		if(reader)
+		for(size_t pos = entry.path.find('/'); pos != std::string::npos; pos = entry.path.find('/', pos + 1))
 		{
-			size_t offset = m_archive->tell();
-			size_t size = reader->size();
-			uint32_t crc = crc32(reader->data(), size);
-			m_archive->w_raw(reader->data(), size);
-			fs.r_close(reader);
+			folders.push_back(entry.path.substr(0, pos + 1));
+		}
+	}
+	std::sort(folders.begin(), folders.end());
+	folders.erase(std::unique(folders.begin(), folders.end()), folders.end());
+
+	std::vector<db_file*> files;
+	files.reserve(entries.size());
+	for(auto& entry : entries)
+	{
+		files.push_back(&entry);
+	}
+
+	write_header(*w, folders, files, version, _lzhuf::LEVEL_REFERENCE);
+	fs.w_close(w);
+	return true;
+}
+
+void db_generator::process(const std::string& destination_path, const db_version& version)
+{
+	if(destination_path.empty())
+	{
+		spdlog::error("Missing destination file path");
+		return;
+	}
+
+	if(version == DB_VERSION_AUTO)
+	{
+		spdlog::error("Unspecified DB format");
+		return;
+	}
 
-			std::string path_lowercase = path;
-			std::transform(path_lowercase.begin(), path_lowercase.end(), path_lowercase.begin(), [](unsigned char c) { return std::tolower(c); });
+	lzo_init();
 
-			auto file = new db_file;
-			file->path = path_lowercase;
-			file->crc = crc;
-			file->offset = offset;
-			file->size_real = size;
-			file->size_compressed = size;
-			m_files.push_back(file);
+	// volumes are cut on the uncompressed sizes, so the split doesn't depend on the codecs
+	std::vector<uint64_t> starts = {0};
+	uint64_t volume_size = 0, total_size = 0;
+	for(uint64_t index = 0; index < m_settings.files; ++index)
+	{
+		uint64_t size = entry_size(index);
+		if(volume_size != 0 && volume_size + size > m_settings.volume_size)
+		{
+			starts.push_back(index);
+			volume_size = 0;
+		}
+		volume_size += size;
+		total_size += size;
+	}
+	starts.push_back(m_settings.files);
+
+	auto start_time = std::chrono::steady_clock::now();
+	uint64_t written = 0;
+	size_t volumes = starts.size() - 1;
+	for(size_t volume = 0; volume < volumes; ++volume)
+	{
+		std::string path = volumes == 1 ? destination_path : destination_path + std::to_string(volume);
+		if(!write_volume(path, version, starts[volume], starts[volume + 1], written))
+		{
+			return;
 		}
 	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+	spdlog::info("generated {} files, {} bytes ({} stored) in {} volume(s) in {:.2f} s", m_settings.files, total_size, written, volumes, elapsed.count());
 }
@@ -2,15 +2,29 @@
 
 #include "xray_re/xr_types.hxx"
 
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <regex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace xray_re
 {
 	class xr_reader;
 	class xr_writer;
+	class xr_file_reader_posix;
+	class xr_folder_cache;
 };
 
+class db_filter;
+
 class db_tools
 {
 public:
@@ -24,6 +38,9 @@ public:
 
 	static void set_debug(const bool value);
 
+	// 0 means one worker per hardware thread
+	void set_jobs(unsigned int jobs);
+
 	enum
 	{
 		DB_CHUNK_DATA     = 0,
@@ -44,9 +61,13 @@ public:
 
 	enum source_format
 	{
-		TOOLS_AUTO      = 0x00,
-		TOOLS_DB_UNPACK = 0x01,
-		TOOLS_DB_PACK   = 0x02
+		TOOLS_AUTO        = 0x00,
+		TOOLS_DB_UNPACK   = 0x01,
+		TOOLS_DB_PACK     = 0x02,
+		TOOLS_DB_UPDATE   = 0x04,
+		TOOLS_DB_COMPACT  = 0x08,
+		TOOLS_DB_GENERATE = 0x10,
+		TOOLS_DB_MOUNT    = 0x20,
 	};
 
 	struct db_file
@@ -58,9 +79,362 @@ public:
 		size_t size_real;
 		size_t size_compressed;
 		unsigned int crc;
+		bool compressed; // 1114 records say so, later formats store packed entries smaller
 	};
 
 	static bool m_debug;
+
+protected:
+	// appends the header chunk: folders then files in the layout of the version, LZHUF-compressed
+	// and, for 2947RU/WW, scrambled
+	static void write_header(xray_re::xr_writer& w, const std::vector<std::string>& folders, const std::vector<db_file*>& files, const db_version& version, unsigned int compression_level);
+
+	unsigned int m_jobs = 1;
+};
+
+// Unpacked entries shared by the readers of any number of archives, keyed by archive id and
+// offset, so entries stored once and listed under several paths are cached once too. The budget
+// is split between shards with their own lock and LRU list, an entry larger than a shard's part
+// is never cached. Pinned entries are skipped by eviction and may take a shard over its part.
+class db_entry_cache
+{
+public:
+	using data_ptr = std::shared_ptr<const std::vector<uint8_t>>;
+
+	struct stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t entries = 0;
+		size_t size = 0;
+	};
+
+	explicit db_entry_cache(size_t budget, unsigned int shards = 16);
+
+	db_entry_cache(const db_entry_cache& that) = delete;
+	db_entry_cache& operator=(const db_entry_cache& right) = delete;
+
+	size_t budget() const;
+
+	// nullptr on a miss
+	data_ptr find(uint32_t archive, uint32_t offset);
+	// returns the cached copy if another reader got there first
+	data_ptr insert(uint32_t archive, uint32_t offset, data_ptr data);
+	// pins nest, false if the entry isn't cached
+	bool pin(uint32_t archive, uint32_t offset);
+	void unpin(uint32_t archive, uint32_t offset);
+	void clear();
+
+	stats get_stats() const;
+
+protected:
+	struct node
+	{
+		uint64_t key;
+		data_ptr data;
+		unsigned int pins;
+	};
+
+	struct shard
+	{
+		mutable std::mutex mutex;
+		std::list<node> lru; // most recently used first
+		std::unordered_map<uint64_t, std::list<node>::iterator> index;
+		size_t size = 0;
+	};
+
+	shard& shard_for(uint64_t key);
+	void evict(shard& s);
+
+protected:
+	size_t m_budget;
+	size_t m_shard_budget;
+	std::vector<std::unique_ptr<shard>> m_shards;
+	std::atomic<uint64_t> m_hits{0};
+	std::atomic<uint64_t> m_misses{0};
+	std::atomic<uint64_t> m_evictions{0};
+};
+
+// Archive opened for random access: the header is parsed once into a path index, entries are
+// then looked up and read straight from the mapped archive. Lookups ignore case and treat '\\'
+// and '/' alike. Const methods may be called from several threads at once.
+// With a memory limit set the archive is never mapped whole: only the header chunk is, while
+// entries are read with pread() and the buffers of all readers together stay below the limit.
+class db_archive: public db_tools
+{
+public:
+	db_archive() = default;
+	~db_archive();
+
+	db_archive(const db_archive& that) = delete;
+	db_archive& operator=(const db_archive& right) = delete;
+
+	// 0 maps the whole archive, must be set before open()
+	void set_memory_limit(size_t bytes);
+	size_t memory_limit() const;
+	// compressed entries are looked up in and added to the cache, which must outlive the archive
+	void set_cache(db_entry_cache *cache);
+	// only files the filter selects are kept, checked on the header name as it is parsed; all
+	// folders are. Must be set before open() and outlive it
+	void set_filter(const db_filter *filter);
+	// unique for every open(), the key of the archive in a cache
+	uint32_t id() const;
+
+	bool open(const std::string& path, const db_version& version);
+	void close();
+	bool is_open() const;
+
+	const std::string& path() const;
+	db_version version() const;
+
+	// files in header order, folders are listed separately
+	const std::vector<db_file>& files() const;
+	const std::vector<std::string>& folders() const;
+
+	const db_file* find(const std::string& path) const;
+	bool read(const std::string& path, std::vector<uint8_t>& buffer) const;
+	bool read(const db_file& file, std::vector<uint8_t>& buffer) const;
+	// contents of the entry shared with the cache, nullptr on failure
+	db_entry_cache::data_ptr read_shared(const db_file& file) const;
+	// every file whose path starts with prefix, in path order
+	void for_each(const std::string& prefix, const std::function<void(const db_file&)>& func) const;
+
+	// writes the contents of the entry to w, copied is set to the number of bytes moved in kernel
+	bool extract(const db_file& file, xray_re::xr_writer& w, size_t& copied) const;
+
+	// stored bytes of the entry, nullptr if it lies outside the archive or the archive isn't mapped
+	const uint8_t* raw_data(const db_file& file) const;
+	bool is_compressed(const db_file& file) const;
+	// descriptor of the archive for in-kernel copies, -1 if there is none
+	int fd() const;
+	bool read_userdata(std::vector<uint8_t>& buffer) const;
+
+	static int compare_paths(std::string_view lhs, std::string_view rhs);
+
+protected:
+	void read_header_1114(xray_re::xr_reader *reader);
+	void read_header_2215(xray_re::xr_reader *reader);
+	void read_header_2945(xray_re::xr_reader *reader);
+	void read_header_2947(xray_re::xr_reader *reader);
+	bool selected(std::string_view name, uint32_t offset) const;
+	void add_entry(std::string_view name, uint32_t offset, uint32_t size_real, uint32_t size_compressed, uint32_t crc, bool compressed);
+
+	xray_re::xr_reader* open_container(uint32_t id) const;
+	void close_container(xray_re::xr_reader *&container) const;
+	bool read_raw(size_t offset, void *dest, size_t length) const;
+	bool read_entry(const db_file& file, std::vector<uint8_t>& buffer, std::vector<uint8_t>& packed) const;
+
+	class memory_lock;
+	size_t acquire_memory(size_t bytes) const;
+	void release_memory(size_t bytes) const;
+
+protected:
+	std::string m_path;
+	db_version m_version = DB_VERSION_AUTO;
+	xray_re::xr_reader *m_reader = nullptr;     // whole archive
+	xray_re::xr_file_reader_posix *m_file = nullptr; // or its pieces, with a memory limit
+	size_t m_size = 0;
+	size_t m_memory_limit = 0;
+	db_entry_cache *m_cache = nullptr;
+	const db_filter *m_filter = nullptr;
+	uint32_t m_id = 0;
+	mutable size_t m_memory_used = 0;
+	mutable std::mutex m_memory_mutex;
+	mutable std::condition_variable m_memory_cv;
+	std::vector<db_file> m_files;
+	std::vector<std::string> m_folders;
+	std::vector<uint32_t> m_index; // m_files sorted by path
+};
+
+// Merged view of a set of archives as the engine mounts them: an entry of a later archive hides
+// the entry with the same path of an earlier one. Nothing is extracted, the winning entries are
+// read from their archives on demand. Lookups follow db_archive::compare_paths().
+class db_overlay: public db_tools
+{
+public:
+	struct entry
+	{
+		const db_archive *archive;
+		const db_file *file;
+	};
+
+	db_overlay() = default;
+
+	db_overlay(const db_overlay& that) = delete;
+	db_overlay& operator=(const db_overlay& right) = delete;
+
+	// see db_archive::set_memory_limit(), split between the archives, must be set before open()
+	void set_memory_limit(size_t bytes);
+	// see db_archive::set_cache(), must be set before open()
+	void set_cache(db_entry_cache *cache);
+	// see db_archive::set_filter(), must be set before open()
+	void set_filter(const db_filter *filter);
+
+	bool open(const std::vector<std::string>& paths, const db_version& version);
+	void close();
+	bool is_open() const;
+
+	// in mount order
+	const std::vector<std::unique_ptr<db_archive>>& archives() const;
+	// winning entries in mount order
+	const std::vector<entry>& entries() const;
+	// number of entries hidden by later archives
+	size_t overridden() const;
+
+	const entry* find(const std::string& path) const;
+	bool stat(const std::string& path, db_file& file) const;
+	bool read(const std::string& path, std::vector<uint8_t>& buffer) const;
+	// reader over the contents of the entry, nullptr if it is missing, free with xr_file_system::r_close()
+	xray_re::xr_reader* open_reader(const std::string& path) const;
+	// every winning entry whose path starts with prefix, in path order
+	void list(const std::string& prefix, const std::function<void(const entry&)>& func) const;
+
+protected:
+	size_t m_memory_limit = 0;
+	db_entry_cache *m_cache = nullptr;
+	const db_filter *m_filter = nullptr;
+	std::vector<std::unique_ptr<db_archive>> m_archives;
+	std::vector<entry> m_entries;
+	std::vector<uint32_t> m_index; // m_entries sorted by path
+	size_t m_overridden = 0;
+};
+
+// Sidecar of an archive, <archive>.cache, remembering the size, mtime and CRC of every packed
+// source file, so that a later repack can tell unchanged files without reading them. It is a
+// header, an array of records sorted by path and the path strings, so load() maps the file and
+// find() searches it in place.
+class db_cache
+{
+public:
+	struct entry
+	{
+		uint64_t size;
+		uint64_t mtime; // nanoseconds
+		uint64_t inode;
+		uint64_t offset; // where the file went in the archive the cache was written for
+		uint32_t size_compressed;
+		uint32_t crc;
+	};
+
+	db_cache() = default;
+	~db_cache();
+
+	db_cache(const db_cache& that) = delete;
+	db_cache& operator=(const db_cache& right) = delete;
+
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+	void clear();
+
+	// looks up the loaded file only, paths are matched the way db_archive::find() does
+	const entry* find(const std::string& path) const;
+	size_t size() const;
+
+	// collects the entries for save()
+	void add(const std::string& path, const entry& value);
+
+	static std::string path_for(const std::string& archive_path);
+
+protected:
+	struct record;
+
+	static std::string key(const std::string& path);
+	std::string_view name(const record& r) const;
+
+	xray_re::xr_reader *m_reader = nullptr;
+	const record *m_records = nullptr;
+	size_t m_count = 0;
+	const char *m_names = nullptr;
+
+	std::vector<std::pair<std::string, entry>> m_added;
+};
+
+// Selects entries by path. A pattern is a glob matched against the whole path, where '*' and '?'
+// stay within a folder, '**' crosses folders and [a-z] or [!a-z] is a set; "re:" starts a regex
+// searched anywhere in the path; anything without wildcards is a substring. A leading '!' makes
+// a pattern exclude. Case is ignored and '\\' is '/'. Globs and substrings run together as one
+// lazily built DFA, so a path is checked in a single pass whatever the number of patterns. Every
+// thread builds its own DFA, so match() takes no lock.
+class db_filter
+{
+public:
+	// not while another thread is in match()
+	bool add(const std::string& pattern);
+	// one pattern per line, blank lines and lines starting with '#' are skipped
+	bool load(const std::string& path);
+
+	bool empty() const;
+	// true if the path matches an include, or there are none, and no exclude
+	bool match(std::string_view path) const;
+
+protected:
+	enum token_type: uint8_t
+	{
+		TOKEN_CHAR,      // one byte of the token's set
+		TOKEN_ANY,       // '?', any byte but '/'
+		TOKEN_STAR,      // '*', a run of bytes without '/'
+		TOKEN_GLOBSTAR,  // '**', any run of bytes
+		TOKEN_FOLDERS,   // "**/", nothing or a run of bytes ending with '/'
+	};
+
+	struct token
+	{
+		token_type type;
+		std::vector<bool> set; // TOKEN_CHAR, indexed by folded byte
+	};
+
+	struct glob
+	{
+		std::vector<token> tokens;
+		bool exclude;
+	};
+
+	struct regex
+	{
+		std::regex re;
+		bool exclude;
+	};
+
+	enum
+	{
+		ACCEPT_INCLUDE = 0x1,
+		ACCEPT_EXCLUDE = 0x2,
+		DFA_MAX_STATES = 4096,
+	};
+
+	static constexpr uint32_t DFA_UNKNOWN = UINT32_MAX;
+
+	using position = std::pair<uint32_t, uint32_t>; // glob, token
+	using state = std::vector<position>;            // sorted NFA positions
+
+	// DFA states are made on first use and all dropped once there are DFA_MAX_STATES of them
+	struct dfa
+	{
+		std::map<state, uint32_t> ids;
+		std::vector<const state*> states;  // keys of ids by id
+		std::vector<uint32_t> transitions; // state * classes + class to state or DFA_UNKNOWN
+		std::vector<uint8_t> accepts;      // ACCEPT_* of every state
+	};
+
+	static uint8_t fold(uint8_t c);
+	bool parse(const std::string& pattern);
+	void compile();
+	dfa& thread_dfa() const;
+	void reset(dfa& d) const;
+	uint32_t add_state(dfa& d, state positions) const;
+	void close(state& positions) const;
+	state step(const state& positions, uint8_t c) const;
+	uint8_t accepts(const state& positions) const;
+
+protected:
+	std::vector<glob> m_globs;
+	std::vector<regex> m_regexes;
+	bool m_has_includes = false;
+
+	uint64_t m_serial = 0;                  // names the DFAs of these patterns in every thread
+	uint8_t m_classes[256] = {};            // byte to the class of bytes no glob tells apart
+	std::vector<uint8_t> m_representatives; // a folded byte of every class
 };
 
 class db_unpacker: public db_tools
@@ -68,13 +442,27 @@ class db_unpacker: public db_tools
 public:
 	~db_unpacker() = default;
 
-	void process(const std::string& source_path, const std::string& destination_path, const db_version& version, const std::string& filter);
+	// filter is a db_filter pattern, empty extracts everything
+	bool process(const std::string& source_path, const std::string& destination_path, const db_version& version, const std::string& filter);
+	// Unpacks a set of archives as one: later archives override entries of earlier ones, the way
+	// the engine mounts them, and all entries are extracted by the same workers into one tree.
+	bool process(const std::vector<std::string>& source_paths, const std::string& destination_path, const db_version& version, const db_filter& filter);
+
+	// see db_archive::set_memory_limit(), split between the archives of a set
+	void set_memory_limit(size_t bytes);
+	// entries of at least this size are written with O_DIRECT, 0 disables it
+	void set_direct_io_threshold(size_t bytes);
+	// budget of a db_entry_cache for compressed entries, 0 disables it
+	void set_cache_size(size_t bytes);
 
 protected:
-	static void extract_1114(const std::string& prefix, const std::string& mask, xray_re::xr_reader *reader, const uint8_t *data);
-	static void extract_2215(const std::string& prefix, const std::string& mask, xray_re::xr_reader *reader, const uint8_t *data);
-	static void extract_2945(const std::string& prefix, const std::string& mask, xray_re::xr_reader *reader, const uint8_t *data);
-	static void extract_2947(const std::string& prefix, const std::string& mask, xray_re::xr_reader *reader, const uint8_t *data);
+	// false if any entry failed
+	bool extract_files(const std::vector<db_overlay::entry>& files, const std::string& prefix, const xray_re::xr_folder_cache& folders);
+
+protected:
+	size_t m_memory_limit = 0;
+	size_t m_direct_io_threshold = 0;
+	size_t m_cache_size = 0;
 };
 
 class db_packer: public db_tools
@@ -84,14 +472,153 @@ public:
 
 	void process(const std::string& source_path, const std::string& destination_path, const db_version& version, const std::string& xdb_ud);
 
+	// LZHUF level for the file table and compressed files, see _lzhuf::Encode
+	void set_compression_level(unsigned int level);
+	// previous build of the archive: files unchanged since then are copied from it
+	void set_base(const std::string& path);
+	// checksums of files unchanged since the last pack are taken from this file
+	void set_cache(const std::string& path);
+	// files with the same contents share one copy of the data
+	void set_dedup(bool value);
+
 protected:
+	struct packed_file
+	{
+		~packed_file();
+
+		std::string path;
+		xray_re::xr_reader *reader = nullptr;
+		uint8_t *data_compressed = nullptr;
+		size_t size = 0;
+		uint32_t size_compressed = 0;
+		uint32_t crc = 0;
+		uint64_t mtime = 0;
+		uint64_t inode = 0;
+		bool crc_cached = false;
+		uint64_t hash = 0;
+		bool hashed = false;
+		const db_file *base = nullptr; // entry of the base archive with the same contents
+	};
+
 	void process_folder(const std::string& path = "");
 	void process_file(const std::string& path);
+	void process_files(const std::vector<std::string>& paths);
 	void add_folder(const std::string& path);
 
+	// pipeline stages: read the source, checksum/compress it, append it to the archive
+	packed_file* read_file(const std::string& path) const;
+	void pack_file(packed_file& file) const;
+	void write_file(const packed_file& file);
+
+	bool open_base(const db_version& version);
+	void hash_contents(packed_file& file, const uint8_t *data) const;
+	std::string group(std::string path) const;
+	const db_file* find_duplicate(const packed_file& file) const;
+
 protected:
 	xray_re::xr_writer *m_archive;
 	std::string m_root;
 	std::vector<std::string> m_folders;
 	std::vector<db_file*> m_files;
+	unsigned int m_compression_level = 0;
+
+	std::string m_base_path;
+	db_archive m_base;
+	size_t m_reused_files = 0;
+	uint64_t m_reused_bytes = 0;
+
+	std::string m_cache_path;
+	db_cache m_base_cache;
+	db_cache m_cache;
+	size_t m_cached_files = 0;
+
+	struct blob
+	{
+		const db_file *entry;
+		std::string path; // of the source
+	};
+
+	bool m_dedup = false;
+	std::unordered_multimap<uint64_t, blob> m_blobs;
+	// Workers compare every hashed file with the earlier hashed ones of the same hash and join the
+	// equal ones in a group, where a path maps to another of its group. Both files are compared
+	// before the later one is written, so the writer only looks the group up.
+	mutable std::mutex m_groups_mutex;
+	mutable std::unordered_multimap<uint64_t, std::string> m_hashed;
+	mutable std::unordered_map<std::string, std::string> m_groups;
+	std::unordered_map<size_t, size_t> m_base_offsets; // offset in the base archive -> offset in this one
+	size_t m_dedup_files = 0;
+	uint64_t m_dedup_bytes = 0;
+};
+
+// Changes an archive in place. New and changed files are appended after the last entry and only
+// the header is rewritten behind them; the data chunk is grown over the old header in a single
+// write once everything else is on the disk, so an interrupted update leaves the old archive.
+// Replaced entries and old headers stay as dead space until compact() rewrites the archive.
+class db_updater: public db_tools
+{
+public:
+	void process(const std::string& source_path, const std::string& archive_path, const db_version& version);
+	void compact(const std::string& archive_path, const db_version& version);
+
+	// LZHUF level for the file table, see _lzhuf::Encode
+	void set_compression_level(unsigned int level);
+
+protected:
+	struct chunk
+	{
+		uint32_t id;
+		size_t offset; // of the chunk header
+		size_t size;
+	};
+
+	static bool read_chunks(const std::string& path, std::vector<chunk>& chunks, size_t& file_size);
+	static bool check_version(const db_version& version);
+
+	unsigned int m_compression_level = 0;
+};
+
+// Writes synthetic archives for scale testing. Sizes, contents and paths of the entries all derive
+// from the seed in integer arithmetic, so the same settings give the same archive on any
+// machine. Entries are generated in memory and streamed into the archive, no source tree is made.
+class db_generator: public db_tools
+{
+public:
+	struct settings
+	{
+		uint64_t files = 1000;
+		uint64_t size_median = 16 * 1024;
+		double size_sigma = 1.0;             // spread of the log-normal sizes, 0 makes every file size_median bytes
+		uint64_t size_max = 64 * 1024 * 1024;
+		double compressibility = 0.5;        // share of the contents drawn from a small vocabulary, the rest is noise
+		bool compress = true;                // store entries LZHUF (1114) or LZO compressed when that makes them smaller
+		unsigned int depth = 3;              // folder levels above the files
+		unsigned int fan_out = 16;           // subfolders per folder
+		unsigned int files_per_folder = 64;
+		uint64_t volume_size = UINT32_MAX - 4096; // offsets are 32-bit, bigger sets are split into volumes
+		uint64_t seed = 1;
+	};
+
+	void set_settings(const settings& value);
+
+	// one volume is written to destination_path, several to destination_path0, destination_path1, ...
+	void process(const std::string& destination_path, const db_version& version);
+
+	// what entry `index` holds, for checking unpacked data against
+	std::string entry_path(uint64_t index) const;
+	uint64_t entry_size(uint64_t index) const;
+	void entry_data(uint64_t index, std::vector<uint8_t>& data) const;
+
+protected:
+	struct blob
+	{
+		std::vector<uint8_t> data;
+		std::vector<uint8_t> packed;
+		uint32_t crc;
+	};
+
+	void make_blob(uint64_t index, const db_version& version, blob& result) const;
+	bool write_volume(const std::string& path, const db_version& version, uint64_t first, uint64_t last, uint64_t& written);
+
+	settings m_settings;
 };
@@ -1,9 +1,16 @@
 #include "db_tools.hxx"
 #include "xray_re/xr_file_system.hxx"
 
+#ifdef DB_CONVERTER_FUSE
+#include "db_mount.hxx"
+#endif
+
 #include <boost/program_options.hpp>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <sys/resource.h>
+
 using namespace xray_re;
 using namespace boost::program_options;
 
@@ -40,30 +47,76 @@ int main(int argc, char *argv[])
 		    ("debug", "enable debug output")
 		    ("ro", "perform all the steps but do not write anything on disk")
 		    ("out", value<std::string>()->value_name("<PATH>"), "output file or folder name")
-		    ("11xx", "assume 1114/1154 archive format (unpack only)")
-		    ("2215", "assume 2215 archive format (unpack only)")
-		    ("2945", "assume 2945/2939 archive format (unpack only)")
+		    ("jobs", value<unsigned int>()->value_name("<N>"), "number of worker threads (0 - one per CPU core)")
+		    ("11xx", "assume 1114/1154 archive format (unpack and generate only)")
+		    ("2215", "assume 2215 archive format (unpack and generate only)")
+		    ("2945", "assume 2945/2939 archive format (unpack and generate only)")
 		    ("2947ru", "assume release version format")
 		    ("2947ww", "assume worldwide release version and 3120 format")
 		    ("xdb", "assume .xdb or .db archive format");
 
 		options_description unpack_options("Unpack options");
 		unpack_options.add_options()
-		    ("unpack", value<std::string>()->value_name("<FILE>"), "unpack game archive")
-		    ("flt", value<std::string>()->value_name("<MASK>"), "extract files filtered by mask");
+		    ("unpack", value<std::vector<std::string>>()->multitoken()->value_name("<FILE>..."), "unpack game archives, later ones override entries of earlier ones (shell patterns are expanded)")
+		    ("flt", value<std::vector<std::string>>()->composing()->value_name("<MASK>"), "extract only matching files, may be repeated: a glob (* ? [a-z] within a folder, ** across folders), re:<regex> or a substring, !<mask> excludes")
+		    ("flt-from", value<std::string>()->value_name("<FILE>"), "read --flt masks from a file, one per line")
+		    ("mem-limit", value<size_t>()->value_name("<MB>"), "read the archive piecewise, buffering at most <MB> megabytes (0 - map it whole)")
+		    ("io-uring", "write extracted files in io_uring batches (falls back to blocking I/O, not with --direct-io)")
+		    ("direct-io", value<size_t>()->value_name("<MB>"), "write files of at least <MB> megabytes with O_DIRECT, bypassing the page cache")
+		    ("cache-size", value<size_t>()->value_name("<MB>"), "keep at most <MB> megabytes of unpacked entries for reuse by entries stored once under several paths (default 0, 64 for --mount)");
 
 		options_description pack_options("Pack options");
 		pack_options.add_options()
 		    ("pack", value<std::string>()->value_name("<DIR>"), "pack game archive")
-		    ("xdb_ud", value<std::string>()->value_name("<FILE>"), "attach user data file");
+		    ("xdb_ud", value<std::string>()->value_name("<FILE>"), "attach user data file")
+		    ("base", value<std::string>()->value_name("<FILE>"), "copy files unchanged since this earlier build of the archive from it, keeps a <out>.cache sidecar")
+		    ("cache", value<std::string>()->value_name("<FILE>"), "take checksums of files unchanged since the last pack from this file, and update it")
+		    ("dedup", "store files with the same contents once")
+		    ("level", value<unsigned int>()->value_name("<N>"), "LZHUF compression level: 0 - reference (default), 1-9 - hash chains, fast to best");
+
+		options_description update_options("Update options");
+		update_options.add_options()
+		    ("update", value<std::string>()->value_name("<DIR>"), "add or replace the files of <DIR> in the --out archive in place")
+		    ("compact", value<std::string>()->value_name("<FILE>"), "rewrite an updated archive without the space of replaced files");
+
+		db_generator::settings generator_defaults;
+		options_description generate_options("Generate options");
+		generate_options.add_options()
+		    ("generate", value<std::string>()->value_name("<FILE>"), "write a synthetic archive for testing")
+		    ("files", value<uint64_t>()->value_name("<N>")->default_value(generator_defaults.files), "number of files")
+		    ("size", value<uint64_t>()->value_name("<BYTES>")->default_value(generator_defaults.size_median), "median file size")
+		    ("size-sigma", value<double>()->value_name("<S>")->default_value(generator_defaults.size_sigma), "spread of the log-normal file sizes, 0 - all files have the median size")
+		    ("max-size", value<uint64_t>()->value_name("<BYTES>")->default_value(generator_defaults.size_max), "largest file size")
+		    ("compressibility", value<double>()->value_name("<0..1>")->default_value(generator_defaults.compressibility), "share of compressible text in the files")
+		    ("stored", "don't compress the files")
+		    ("depth", value<unsigned int>()->value_name("<N>")->default_value(generator_defaults.depth), "folder levels above the files")
+		    ("fan-out", value<unsigned int>()->value_name("<N>")->default_value(generator_defaults.fan_out), "subfolders per folder")
+		    ("folder-files", value<unsigned int>()->value_name("<N>")->default_value(generator_defaults.files_per_folder), "files per folder")
+		    ("volume-size", value<uint64_t>()->value_name("<MB>"), "split into volumes <out>0, <out>1, ... of at most <MB> megabytes (default and maximum 4 GB)")
+		    ("seed", value<uint64_t>()->value_name("<N>")->default_value(generator_defaults.seed), "seed of the sizes, contents and names");
+
+#ifdef DB_CONVERTER_FUSE
+		options_description mount_options("Mount options");
+		mount_options.add_options()
+		    ("mount", value<std::vector<std::string>>()->multitoken()->value_name("<FILE>... <DIR>"), "serve archives read-only on <DIR> until \"fusermount -u <DIR>\", later ones override earlier ones");
+#endif
 
 		options_description all_options;
-		all_options.add(common_options).add(unpack_options).add(pack_options);
+		all_options.add(common_options).add(unpack_options).add(pack_options).add(update_options).add(generate_options);
+#ifdef DB_CONVERTER_FUSE
+		all_options.add(mount_options);
+#endif
 
 		variables_map vm;
 		store(parse_command_line(argc, argv, all_options), vm);
 		notify(vm);
 
+		unsigned int jobs = 1;
+		if(vm.count("jobs"))
+		{
+			jobs = vm["jobs"].as<unsigned int>();
+		}
+
 		bool debug = false;
 		if(vm.count("debug"))
 		{
@@ -75,6 +128,7 @@ int main(int argc, char *argv[])
 		{
 			spdlog::info("Usage examples:");
 			spdlog::info("  db_converter --unpack resources.db0 --xdb --dir ~/extracted");
+			spdlog::info("  db_converter --unpack 'resources.db*' 'patches/*.xdb*' --xdb --out ~/extracted");
 			spdlog::info( "  db_converter --pack ~/dir_to_pack/ --out ~/packed.db --xdb");
 			std::stringstream all_options_string;
 			all_options_string << all_options;
@@ -83,7 +137,7 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
-		if(conflicting_options_exist(vm, {"pack", "unpack"}))
+		if(conflicting_options_exist(vm, {"pack", "unpack", "update", "compact", "generate", "mount"}))
 		{
 			return 1;
 		}
@@ -93,6 +147,12 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
+		// the ring writes through the page cache
+		if(conflicting_options_exist(vm, {"io-uring", "direct-io"}))
+		{
+			return 1;
+		}
+
 		unsigned short int tools_type = db_tools::TOOLS_AUTO;
 
 		if (vm.count("unpack"))
@@ -105,6 +165,26 @@ int main(int argc, char *argv[])
 			tools_type = db_tools::TOOLS_DB_PACK;
 		}
 
+		if (vm.count("update"))
+		{
+			tools_type = db_tools::TOOLS_DB_UPDATE;
+		}
+
+		if (vm.count("compact"))
+		{
+			tools_type = db_tools::TOOLS_DB_COMPACT;
+		}
+
+		if (vm.count("generate"))
+		{
+			tools_type = db_tools::TOOLS_DB_GENERATE;
+		}
+
+		if (vm.count("mount"))
+		{
+			tools_type = db_tools::TOOLS_DB_MOUNT;
+		}
+
 		std::string fs_spec;
 
 		unsigned int fs_flags = 0;
@@ -114,6 +194,19 @@ int main(int argc, char *argv[])
 			spdlog::info("Working in read-only mode");
 		}
 
+		if (vm.count("io-uring"))
+		{
+			fs_flags |= xr_file_system::FSF_IO_URING;
+		}
+
+		// output folders are kept open while unpacking, the more descriptors the more of them
+		struct rlimit limit {};
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+		{
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+
 		xr_file_system& fs = xr_file_system::instance();
 		if (!fs.initialize(fs_spec, fs_flags))
 		{
@@ -159,12 +252,36 @@ int main(int argc, char *argv[])
 			return version;
 		};
 
+		// archives named on the command line, shell patterns are expanded in sorted order
+		auto expand_archives = [](const std::vector<std::string>& patterns, std::vector<std::string>& paths)
+		{
+			bool matched = true;
+			for(const auto& pattern : patterns)
+			{
+				if(pattern.find_first_of("*?[") == std::string::npos)
+				{
+					paths.push_back(pattern);
+				}
+				else if(!xr_file_system::expand_glob(pattern, paths))
+				{
+					spdlog::error("No archive matches \"{}\"", pattern);
+					matched = false;
+				}
+			}
+			return matched && !paths.empty();
+		};
+
 		switch (tools_type)
 		{
 			case db_tools::TOOLS_DB_UNPACK:
 			{
-				std::string source_path = vm["unpack"].as<std::string>();
-				auto path_splitted = xr_file_system::split_path(source_path);
+				std::vector<std::string> source_paths;
+				if(!expand_archives(vm["unpack"].as<std::vector<std::string>>(), source_paths))
+				{
+					break;
+				}
+
+				auto path_splitted = xr_file_system::split_path(source_paths.front());
 				std::string extension = path_splitted.extension;
 
 				std::string destination_path = vm.count("out") ? vm["out"].as<std::string>() : "";
@@ -177,15 +294,44 @@ int main(int argc, char *argv[])
 					break;
 				}
 
-				std::string filter;
+				db_filter filter;
+				bool filter_ok = true;
 				if(vm.count("flt"))
 				{
-					filter = vm["flt"].as<std::string>();
+					for(const auto& mask : vm["flt"].as<std::vector<std::string>>())
+					{
+						filter_ok &= filter.add(mask);
+					}
+				}
+				if(vm.count("flt-from"))
+				{
+					filter_ok &= filter.load(vm["flt-from"].as<std::string>());
+				}
+
+				if(!filter_ok)
+				{
+					break;
 				}
 
 				db_unpacker unpacker;
 				unpacker.set_debug(debug);
-				unpacker.process(source_path, destination_path, version, filter);
+				unpacker.set_jobs(jobs);
+				if(vm.count("mem-limit"))
+				{
+					unpacker.set_memory_limit(vm["mem-limit"].as<size_t>() * 1024 * 1024);
+				}
+				if(vm.count("direct-io"))
+				{
+					unpacker.set_direct_io_threshold(std::max<size_t>(vm["direct-io"].as<size_t>() * 1024 * 1024, 1));
+				}
+				if(vm.count("cache-size"))
+				{
+					unpacker.set_cache_size(vm["cache-size"].as<size_t>() * 1024 * 1024);
+				}
+				if(!unpacker.process(source_paths, destination_path, version, filter))
+				{
+					return 1;
+				}
 				break;
 			}
 			case db_tools::TOOLS_DB_PACK:
@@ -204,12 +350,6 @@ int main(int argc, char *argv[])
 					break;
 				}
 
-				std::string filter;
-				if(vm.count("flt"))
-				{
-					filter = vm["flt"].as<std::string>();
-				}
-
 				std::string xdb_ud;
 				if(vm.count("xdb_ud"))
 				{
@@ -218,9 +358,139 @@ int main(int argc, char *argv[])
 
 				db_packer packer;
 				packer.set_debug(debug);
+				packer.set_jobs(jobs);
+				if(vm.count("level"))
+				{
+					packer.set_compression_level(vm["level"].as<unsigned int>());
+				}
+				if(vm.count("base"))
+				{
+					packer.set_base(vm["base"].as<std::string>());
+				}
+				if(vm.count("cache"))
+				{
+					packer.set_cache(vm["cache"].as<std::string>());
+				}
+				if(vm.count("dedup"))
+				{
+					packer.set_dedup(true);
+				}
 				packer.process(source_path, destination_path, version, xdb_ud);
 				break;
 			}
+			case db_tools::TOOLS_DB_UPDATE:
+			case db_tools::TOOLS_DB_COMPACT:
+			{
+				std::string archive_path = tools_type == db_tools::TOOLS_DB_COMPACT ? vm["compact"].as<std::string>() : vm.count("out") ? vm["out"].as<std::string>() : "";
+				auto path_splitted = xr_file_system::split_path(archive_path);
+				std::string extension = path_splitted.extension;
+
+				db_tools::db_version version = get_db_version(vm, extension);
+
+				if (version == db_tools::DB_VERSION_AUTO)
+				{
+					spdlog::error("unspecified DB format");
+					break;
+				}
+
+				db_updater updater;
+				updater.set_debug(debug);
+				if(vm.count("level"))
+				{
+					updater.set_compression_level(vm["level"].as<unsigned int>());
+				}
+
+				if(tools_type == db_tools::TOOLS_DB_COMPACT)
+				{
+					updater.compact(archive_path, version);
+				}
+				else
+				{
+					updater.process(vm["update"].as<std::string>(), archive_path, version);
+				}
+				break;
+			}
+			case db_tools::TOOLS_DB_GENERATE:
+			{
+				std::string destination_path = vm["generate"].as<std::string>();
+				auto path_splitted = xr_file_system::split_path(destination_path);
+				std::string extension = path_splitted.extension;
+
+				db_tools::db_version version = get_db_version(vm, extension);
+
+				if (version == db_tools::DB_VERSION_AUTO)
+				{
+					spdlog::error("unspecified DB format");
+					break;
+				}
+
+				db_generator::settings settings;
+				settings.files = vm["files"].as<uint64_t>();
+				settings.size_median = vm["size"].as<uint64_t>();
+				settings.size_sigma = vm["size-sigma"].as<double>();
+				settings.size_max = vm["max-size"].as<uint64_t>();
+				settings.compressibility = std::clamp(vm["compressibility"].as<double>(), 0.0, 1.0);
+				settings.compress = vm.count("stored") == 0;
+				settings.depth = vm["depth"].as<unsigned int>();
+				settings.fan_out = vm["fan-out"].as<unsigned int>();
+				settings.files_per_folder = vm["folder-files"].as<unsigned int>();
+				settings.seed = vm["seed"].as<uint64_t>();
+				if(vm.count("volume-size"))
+				{
+					settings.volume_size = std::clamp<uint64_t>(vm["volume-size"].as<uint64_t>() * 1024 * 1024, 1, generator_defaults.volume_size);
+				}
+
+				db_generator generator;
+				generator.set_debug(debug);
+				generator.set_jobs(jobs);
+				generator.set_settings(settings);
+				generator.process(destination_path, version);
+				break;
+			}
+#ifdef DB_CONVERTER_FUSE
+			case db_tools::TOOLS_DB_MOUNT:
+			{
+				std::vector<std::string> patterns = vm["mount"].as<std::vector<std::string>>();
+				if(patterns.size() < 2)
+				{
+					spdlog::error("--mount needs the archives and then the mount point");
+					break;
+				}
+
+				std::string mount_point = patterns.back();
+				patterns.pop_back();
+
+				std::vector<std::string> source_paths;
+				if(!expand_archives(patterns, source_paths))
+				{
+					break;
+				}
+
+				db_tools::db_version version = get_db_version(vm, xr_file_system::split_path(source_paths.front()).extension);
+
+				if (version == db_tools::DB_VERSION_AUTO)
+				{
+					spdlog::error("unspecified DB format");
+					break;
+				}
+
+				db_mount mount;
+				mount.set_debug(debug);
+				if(vm.count("mem-limit"))
+				{
+					mount.set_memory_limit(vm["mem-limit"].as<size_t>() * 1024 * 1024);
+				}
+				if(vm.count("cache-size"))
+				{
+					mount.set_cache_size(vm["cache-size"].as<size_t>() * 1024 * 1024);
+				}
+				if(!mount.process(source_paths, mount_point, version))
+				{
+					return 1;
+				}
+				break;
+			}
+#endif
 			default:
 			{
 				spdlog::info("No tools selected");
@@ -4,11 +4,17 @@
 #include <spdlog/spdlog.h>
 
 #include <filesystem>
+#include <glob.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstring>
 
@@ -28,6 +34,7 @@ xr_file_system& xr_file_system::instance()
 }
 
 bool xr_file_system::read_only() const { return !!(m_flags & FSF_READ_ONLY); }
+bool xr_file_system::io_uring() const { return !!(m_flags & FSF_IO_URING); }
 
 bool xr_file_system::initialize(const std::string& fs_spec, unsigned flags)
 {
@@ -51,6 +58,12 @@ bool xr_file_system::initialize(const std::string& fs_spec, unsigned flags)
 	{
 		add_path_alias(PA_FS_ROOT, "", "");
 	}
+	if((flags & FSF_IO_URING) && !xr_uring::supported())
+	{
+		spdlog::warn("io_uring is not available, falling back to blocking I/O");
+		flags &= ~FSF_IO_URING;
+	}
+
 	m_flags = flags;
 	return !m_aliases.empty();
 }
@@ -121,7 +134,25 @@ xr_writer* xr_file_system::w_open(const std::string& path, bool ignore_ro) const
 		return new xr_fake_writer();
 	}
 
-	auto fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+	auto fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+	if(fd == -1)
+	{
+		return nullptr;
+	}
+
+	xr_writer *writer = new xr_file_writer_posix(fd);
+	return writer;
+}
+
+xr_writer* xr_file_system::w_open_existing(const std::string& path, bool ignore_ro) const
+{
+	if(!ignore_ro && read_only())
+	{
+		return new xr_fake_writer();
+	}
+
+	auto fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
 
 	if(fd == -1)
 	{
@@ -132,6 +163,47 @@ xr_writer* xr_file_system::w_open(const std::string& path, bool ignore_ro) const
 	return writer;
 }
 
+xr_writer* xr_file_system::w_open_at(int dirfd, const std::string& name, bool ignore_ro) const
+{
+	if(!ignore_ro && read_only())
+	{
+		return new xr_fake_writer();
+	}
+
+	auto fd = openat(dirfd, name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+	if(fd == -1)
+	{
+		return nullptr;
+	}
+
+	return new xr_file_writer_posix(fd);
+}
+
+xr_writer* xr_file_system::w_open_direct_at(int dirfd, const std::string& name, bool ignore_ro) const
+{
+	if(!ignore_ro && read_only())
+	{
+		return new xr_fake_writer();
+	}
+
+	auto fd = openat(dirfd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0666);
+
+	if(fd == -1)
+	{
+		return nullptr;
+	}
+
+	auto writer = new xr_direct_writer_posix(fd);
+	if(!writer->is_open())
+	{
+		delete writer;
+		return nullptr;
+	}
+
+	return writer;
+}
+
 xr_writer* xr_file_system::w_open(const std::string& path, const std::string& name,  bool ignore_ro) const
 {
 	const path_alias *pa = find_path_alias(path);
@@ -140,6 +212,88 @@ xr_writer* xr_file_system::w_open(const std::string& path, const std::string& na
 
 void xr_file_system::w_close(xr_writer *&w) { delete w; w = nullptr; }
 
+// returns errno of the failed step or 0
+static int write_whole_file(int dirfd, const std::string& path, const void *data, size_t size)
+{
+	int fd = ::openat(dirfd, path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(fd == -1)
+	{
+		return errno;
+	}
+
+	int error = 0;
+	for(auto p = static_cast<const uint8_t*>(data); size != 0;)
+	{
+		auto res = ::write(fd, p, size);
+		if(res == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(res <= 0)
+		{
+			error = res == 0 ? EIO : errno;
+			break;
+		}
+
+		p += res;
+		size -= static_cast<size_t>(res);
+	}
+
+	if(::close(fd) == -1 && error == 0)
+	{
+		error = errno;
+	}
+
+	return error;
+}
+
+void xr_file_system::write_files(xr_write_request *requests, size_t count) const
+{
+	if(read_only())
+	{
+		for(size_t i = 0; i < count; ++i)
+		{
+			requests[i].error = 0;
+		}
+		return;
+	}
+
+	bool ring_used = false;
+	if(io_uring())
+	{
+		// a ring per thread, so that workers don't contend for one
+		static thread_local xr_uring ring(URING_ENTRIES);
+		ring.write_files(requests, count);
+		ring_used = true;
+	}
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		xr_write_request& r = requests[i];
+		if(ring_used && r.error == 0)
+		{
+			continue;
+		}
+
+		r.error = write_whole_file(r.dirfd, r.path, r.data, r.size);
+		if(r.error == ENOENT && r.dirfd == AT_FDCWD)
+		{
+			if(!create_path(split_path(r.path).folder))
+			{
+				spdlog::error("Failed to create folder {}", split_path(r.path).folder);
+				continue;
+			}
+			r.error = write_whole_file(r.dirfd, r.path, r.data, r.size);
+		}
+
+		if(r.error != 0)
+		{
+			spdlog::error("Failed to write file \"{}\": {} (errno={}) ", r.path, strerror(r.error), r.error);
+		}
+	}
+}
+
 bool xr_file_system::copy_file(const std::string &src_path, const std::string &src_name, const std::string &tgt_path, const std::string &tgt_name) const
 {
 	const path_alias *src_pa = find_path_alias(src_path);
@@ -189,6 +343,27 @@ bool xr_file_system::folder_exist(const std::string& path)
 	return std::filesystem::exists(path) && std::filesystem::is_directory(path);
 }
 
+bool xr_file_system::expand_glob(const std::string& pattern, std::vector<std::string>& paths)
+{
+	glob_t matches {};
+	size_t found = 0;
+	if(glob(pattern.c_str(), 0, nullptr, &matches) == 0)
+	{
+		// folders matching the pattern don't count
+		for(size_t i = 0; i < matches.gl_pathc; ++i)
+		{
+			if(file_exist(matches.gl_pathv[i]))
+			{
+				paths.emplace_back(matches.gl_pathv[i]);
+				++found;
+			}
+		}
+	}
+	globfree(&matches);
+
+	return found != 0;
+}
+
 bool xr_file_system::create_path(const std::string& path) const
 {
 	if(read_only())
@@ -502,14 +677,245 @@ xr_mmap_reader_posix::~xr_mmap_reader_posix()
 	}
 }
 
-xr_file_writer_posix::xr_file_writer_posix(): m_fd(-1) {}
+xr_folder_cache::xr_folder_cache(): m_root_fd(-1), m_open(0) {}
+
+xr_folder_cache::~xr_folder_cache()
+{
+	close();
+}
+
+bool xr_folder_cache::create(const std::string& root, std::vector<std::string> folders)
+{
+	close();
+
+	m_root_fd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(m_root_fd == -1)
+	{
+		spdlog::error("Failed to open folder \"{}\": {} (errno={}) ", root, strerror(errno), errno);
+		return false;
+	}
+
+	// folders are kept open up to a quarter of the descriptor limit, the rest is left to the output
+	// files, the archives and the ring; folders past that are made by path and have no descriptor
+	size_t open_max = 64;
+	struct rlimit limit {};
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		open_max = limit.rlim_cur == RLIM_INFINITY ? SIZE_MAX : static_cast<size_t>(limit.rlim_cur / 4);
+	}
+
+	std::vector<std::string> parents;
+	for(auto& folder : folders)
+	{
+		while(!folder.empty() && folder.back() == '/')
+		{
+			folder.pop_back();
+		}
 
-xr_file_writer_posix::xr_file_writer_posix(int fd): m_fd(fd) {}
+		for(size_t slash = folder.rfind('/'); slash != std::string::npos && slash != 0; slash = folder.rfind('/', slash - 1))
+		{
+			parents.push_back(folder.substr(0, slash));
+		}
+	}
+	folders.insert(folders.end(), parents.begin(), parents.end());
+
+	// a parent sorts right before its children
+	std::sort(folders.begin(), folders.end());
+	folders.erase(std::unique(folders.begin(), folders.end()), folders.end());
+	if(!folders.empty() && folders.front().empty())
+	{
+		folders.erase(folders.begin());
+	}
+
+	bool result = true;
+	m_folders.reserve(folders.size());
+	for(auto& folder : folders)
+	{
+		size_t slash = folder.rfind('/');
+		int parent_fd = slash == std::string::npos ? m_root_fd : fd(std::string_view(folder).substr(0, slash));
+		std::string name = slash == std::string::npos ? folder : folder.substr(slash + 1);
+
+		int folder_fd = -1;
+		if(parent_fd != -1)
+		{
+			if(mkdirat(parent_fd, name.c_str(), 0777) == -1 && errno != EEXIST)
+			{
+				spdlog::error("Failed to create folder \"{}/{}\": {} (errno={}) ", root, folder, strerror(errno), errno);
+				result = false;
+			}
+			else if(m_open < open_max)
+			{
+				folder_fd = openat(parent_fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+				m_open += folder_fd != -1;
+			}
+		}
+		else if(!std::filesystem::exists(root + "/" + folder))
+		{
+			// the parent is there but couldn't be kept open
+			std::error_code error;
+			result = std::filesystem::create_directories(root + "/" + folder, error) && result;
+		}
+
+		m_folders.emplace_back(std::move(folder), folder_fd);
+	}
+
+	return result;
+}
+
+void xr_folder_cache::close()
+{
+	for(const auto& folder : m_folders)
+	{
+		if(folder.second != -1)
+		{
+			::close(folder.second);
+		}
+	}
+	m_folders.clear();
+	m_open = 0;
+
+	if(m_root_fd != -1)
+	{
+		::close(m_root_fd);
+		m_root_fd = -1;
+	}
+}
+
+int xr_folder_cache::fd(std::string_view folder) const
+{
+	if(folder.empty())
+	{
+		return m_root_fd;
+	}
+
+	auto it = std::lower_bound(m_folders.begin(), m_folders.end(), folder, [](const std::pair<std::string, int>& lhs, std::string_view rhs)
+	{
+		return std::string_view(lhs.first) < rhs;
+	});
+
+	return it != m_folders.end() && it->first == folder ? it->second : -1;
+}
+
+xr_mmap_window_posix::xr_mmap_window_posix(void *base, size_t mem_length, size_t delta, size_t length) :
+    xr_reader(static_cast<uint8_t*>(base) + delta, length), m_base(base), m_mem_length(mem_length) {}
+
+xr_mmap_window_posix::~xr_mmap_window_posix()
+{
+	if(munmap(m_base, m_mem_length) != 0)
+	{
+		spdlog::error("munmap failed: {} (errno={}) ", strerror(errno), errno);
+	}
+}
+
+xr_file_reader_posix::xr_file_reader_posix(): m_fd(-1), m_size(0) {}
+
+xr_file_reader_posix::~xr_file_reader_posix()
+{
+	close();
+}
+
+bool xr_file_reader_posix::open(const std::string& path)
+{
+	close();
+
+	m_fd = ::open(path.c_str(), O_RDONLY);
+	if(m_fd == -1)
+	{
+		spdlog::error("Failed to open file \"{}\": {} (errno={}) ", path, strerror(errno), errno);
+		return false;
+	}
+
+	struct stat sb {};
+	if(fstat(m_fd, &sb) == -1)
+	{
+		spdlog::error("stat failed for file \"{}\": {} (errno={}) ", path, strerror(errno), errno);
+		close();
+		return false;
+	}
+
+	m_size = static_cast<size_t>(sb.st_size);
+	return true;
+}
+
+void xr_file_reader_posix::close()
+{
+	if(m_fd != -1 && ::close(m_fd) == -1)
+	{
+		spdlog::error("Failed to close file descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+	}
+
+	m_fd = -1;
+	m_size = 0;
+}
+
+bool xr_file_reader_posix::r_raw(size_t offset, void *dest, size_t length) const
+{
+	if(offset > m_size || length > m_size - offset)
+	{
+		return false;
+	}
+
+	auto p = static_cast<uint8_t*>(dest);
+	while(length != 0)
+	{
+		auto res = ::pread64(m_fd, p, length, static_cast<off64_t>(offset));
+		if(res == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(res <= 0)
+		{
+			spdlog::error("Failed to read from descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+			return false;
+		}
+
+		p += res;
+		offset += static_cast<size_t>(res);
+		length -= static_cast<size_t>(res);
+	}
+
+	return true;
+}
+
+xr_reader* xr_file_reader_posix::map(size_t offset, size_t length) const
+{
+	if(offset > m_size || length > m_size - offset || length == 0)
+	{
+		return nullptr;
+	}
+
+	auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t delta = offset % page_size;
+	size_t mem_length = delta + length;
+
+	void *base = mmap(nullptr, mem_length, PROT_READ, MAP_PRIVATE, m_fd, static_cast<off_t>(offset - delta));
+	if(base == MAP_FAILED)
+	{
+		spdlog::error("mmap failed for descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+		return nullptr;
+	}
+
+	return new xr_mmap_window_posix(base, mem_length, delta, length);
+}
+
+xr_file_writer_posix::xr_file_writer_posix(): m_fd(-1), m_pos(0), m_buffer_size(0) {}
+
+xr_file_writer_posix::xr_file_writer_posix(int fd, size_t buffer_size): m_fd(fd), m_pos(0), m_buffer_size(buffer_size)
+{
+	auto res = ::lseek64(m_fd, 0, SEEK_CUR);
+	if(res != -1)
+	{
+		m_pos = static_cast<size_t>(res);
+	}
+}
 
 xr_file_writer_posix::~xr_file_writer_posix()
 {
 	assert(m_fd != -1);
 
+	flush();
+
 	auto res = ::close(m_fd);
 	if(res == -1)
 	{
@@ -517,35 +923,362 @@ xr_file_writer_posix::~xr_file_writer_posix()
 	}
 }
 
-void xr_file_writer_posix::w_raw(const void *data, size_t length)
+void xr_file_writer_posix::write_all(const void *head, size_t head_length, const void *tail, size_t tail_length)
 {
-	auto res = ::write(m_fd, data, length);
-
-	if(length != 0 && data != MAP_FAILED)
+	struct iovec iov[2] = {
+		{const_cast<void*>(head), head_length},
+		{const_cast<void*>(tail), tail_length},
+	};
+	struct iovec *first = head_length != 0 ? iov : iov + 1;
+	int count = static_cast<int>(iov + 2 - first);
+	size_t left = head_length + tail_length;
+
+	while(left != 0)
 	{
+		auto res = ::writev(m_fd, first, count);
+		if(res == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
 		if(res == -1)
 		{
 			spdlog::error("Failed to write to descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
 		}
+		xr_assert(res > 0);
+
+		auto written = static_cast<size_t>(res);
+		m_pos += written;
+		left -= written;
+
+		// drop what's done and retry the rest
+		while(count != 0 && written >= first->iov_len)
+		{
+			written -= first->iov_len;
+			++first;
+			--count;
+		}
 
-		xr_assert(static_cast<size_t>(res) == length);
+		if(count != 0)
+		{
+			first->iov_base = static_cast<uint8_t*>(first->iov_base) + written;
+			first->iov_len -= written;
+		}
+	}
+}
+
+void xr_file_writer_posix::flush()
+{
+	if(!m_buffer.empty())
+	{
+		write_all(m_buffer.data(), m_buffer.size(), nullptr, 0);
+		m_buffer.clear();
 	}
 }
 
+bool xr_file_writer_posix::sync()
+{
+	flush();
+
+	if(fdatasync(m_fd) == -1)
+	{
+		spdlog::error("fdatasync failed: {} (errno={})", strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+void xr_file_writer_posix::set_buffer_size(size_t buffer_size)
+{
+	flush();
+	m_buffer_size = buffer_size;
+	m_buffer.shrink_to_fit();
+}
+
+void xr_file_writer_posix::w_raw(const void *data, size_t length)
+{
+	if(length == 0)
+	{
+		return;
+	}
+
+	if(m_buffer.size() + length <= m_buffer_size)
+	{
+		if(m_buffer.capacity() < m_buffer_size)
+		{
+			m_buffer.reserve(m_buffer_size);
+		}
+		auto p = static_cast<const uint8_t*>(data);
+		m_buffer.insert(m_buffer.end(), p, p + length);
+		return;
+	}
+
+	if(length < m_buffer_size)
+	{
+		flush();
+		w_raw(data, length);
+		return;
+	}
+
+	write_all(m_buffer.data(), m_buffer.size(), data, length);
+	m_buffer.clear();
+}
+
 void xr_file_writer_posix::seek(size_t pos)
 {
+	flush();
+
 	auto res = ::lseek64(m_fd, static_cast<off_t>(pos), SEEK_SET);
 
 	xr_assert(static_cast<size_t>(res) == pos);
+	m_pos = pos;
 }
 
 size_t xr_file_writer_posix::tell()
 {
-	auto res = ::lseek64(m_fd, 0, SEEK_CUR);
-	if(res == -1)
+	return m_pos + m_buffer.size();
+}
+
+void xr_file_writer_posix::w_raw_at(size_t pos, const void *data, size_t length)
+{
+	auto p = static_cast<const uint8_t*>(data);
+
+	// the part still in the buffer is patched there
+	if(pos + length > m_pos && !m_buffer.empty())
+	{
+		size_t from = std::max(pos, m_pos);
+		size_t to = std::min(pos + length, tell());
+		if(from < to)
+		{
+			std::memcpy(m_buffer.data() + (from - m_pos), p + (from - pos), to - from);
+		}
+		length = std::min(length, m_pos > pos ? m_pos - pos : 0);
+	}
+
+	while(length != 0)
+	{
+		auto res = ::pwrite64(m_fd, p, length, static_cast<off64_t>(pos));
+		if(res == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(res == -1)
+		{
+			spdlog::error("Failed to write to descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+		}
+		xr_assert(res > 0);
+
+		p += res;
+		pos += static_cast<size_t>(res);
+		length -= static_cast<size_t>(res);
+	}
+}
+
+void xr_file_writer_posix::reserve(size_t size)
+{
+	// small files are written in one go anyway
+	if(size < m_buffer_size)
+	{
+		return;
+	}
+
+	// the size stays as written, so a failed extraction doesn't look like a finished file
+	if(::fallocate64(m_fd, FALLOC_FL_KEEP_SIZE, static_cast<off64_t>(tell()), static_cast<off64_t>(size)) == -1 && errno != EOPNOTSUPP)
+	{
+		spdlog::debug("fallocate failed for descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+	}
+}
+
+bool xr_file_writer_posix::w_copy(int fd, size_t offset, size_t length)
+{
+	// both stay off once the kernel or the file systems involved turned them down
+	static std::atomic<bool> copy_file_range_ok{true};
+	static std::atomic<bool> sendfile_ok{true};
+
+	flush();
+
+	size_t start = m_pos;
+	auto in_offset = static_cast<off64_t>(offset);
+	size_t copied = 0;
+
+	while(copied < length)
+	{
+		ssize_t res = -1;
+		bool use_copy_file_range = copy_file_range_ok.load(std::memory_order_relaxed);
+
+		if(use_copy_file_range)
+		{
+			res = ::copy_file_range(fd, &in_offset, m_fd, nullptr, length - copied, 0);
+		}
+		else if(sendfile_ok.load(std::memory_order_relaxed))
+		{
+			res = ::sendfile64(m_fd, fd, &in_offset, length - copied);
+		}
+		else
+		{
+			break;
+		}
+
+		if(res == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			if(copied == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+			{
+				(use_copy_file_range ? copy_file_range_ok : sendfile_ok).store(false, std::memory_order_relaxed);
+				continue;
+			}
+
+			spdlog::error("Failed to copy to descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+			break;
+		}
+
+		if(res == 0)
+		{
+			break;
+		}
+
+		copied += static_cast<size_t>(res);
+	}
+
+	if(copied == length)
+	{
+		m_pos += copied;
+		return true;
+	}
+
+	// let the caller write everything the usual way
+	::lseek64(m_fd, static_cast<off_t>(start), SEEK_SET);
+	return false;
+}
+
+xr_direct_writer_posix::xr_direct_writer_posix(int fd): m_fd(fd), m_pos(0), m_used(0), m_buffer(nullptr)
+{
+	void *buffer = nullptr;
+	if(posix_memalign(&buffer, ALIGNMENT, BUFFER_SIZE) == 0)
+	{
+		m_buffer = static_cast<uint8_t*>(buffer);
+	}
+}
+
+xr_direct_writer_posix::~xr_direct_writer_posix()
+{
+	if(m_buffer != nullptr)
+	{
+		flush(true);
+		free(m_buffer);
+	}
+
+	if(m_fd != -1 && ::close(m_fd) == -1)
 	{
 		spdlog::error("Failed to close file descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
 	}
+}
 
-	return static_cast<size_t>(res);
+bool xr_direct_writer_posix::is_open() const { return m_fd != -1 && m_buffer != nullptr; }
+
+// writes the whole blocks of the buffer, and with tail also the rest without O_DIRECT
+void xr_direct_writer_posix::flush(bool tail)
+{
+	// after a seek to an unaligned offset, nothing can be written directly
+	if(m_pos % ALIGNMENT != 0)
+	{
+		tail = true;
+	}
+
+	size_t length = m_pos % ALIGNMENT == 0 ? m_used - m_used % ALIGNMENT : 0;
+	size_t done = 0;
+
+	while(done < length)
+	{
+		auto res = ::pwrite64(m_fd, m_buffer + done, length - done, static_cast<off64_t>(m_pos + done));
+		if(res == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(res <= 0 || res % ALIGNMENT != 0)
+		{
+			// leave the rest to the page cache
+			if(res > 0)
+			{
+				done += static_cast<size_t>(res);
+			}
+			tail = true;
+			break;
+		}
+
+		done += static_cast<size_t>(res);
+	}
+
+	if(tail && done < m_used)
+	{
+		int flags = fcntl(m_fd, F_GETFL);
+		fcntl(m_fd, F_SETFL, flags & ~O_DIRECT);
+
+		for(size_t end = m_used; done < end;)
+		{
+			auto res = ::pwrite64(m_fd, m_buffer + done, end - done, static_cast<off64_t>(m_pos + done));
+			if(res == -1 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if(res == -1)
+			{
+				spdlog::error("Failed to write to descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+			}
+			xr_assert(res > 0);
+
+			done += static_cast<size_t>(res);
+		}
+
+		fcntl(m_fd, F_SETFL, flags);
+	}
+
+	std::memmove(m_buffer, m_buffer + done, m_used - done);
+	m_pos += done;
+	m_used -= done;
+}
+
+void xr_direct_writer_posix::w_raw(const void *data, size_t length)
+{
+	auto p = static_cast<const uint8_t*>(data);
+	while(length != 0)
+	{
+		size_t size = std::min(length, static_cast<size_t>(BUFFER_SIZE) - m_used);
+		std::memcpy(m_buffer + m_used, p, size);
+		m_used += size;
+		p += size;
+		length -= size;
+
+		if(m_used == BUFFER_SIZE)
+		{
+			flush(false);
+		}
+	}
+}
+
+void xr_direct_writer_posix::seek(size_t pos)
+{
+	flush(true);
+	m_pos = pos;
+}
+
+size_t xr_direct_writer_posix::tell()
+{
+	return m_pos + m_used;
+}
+
+void xr_direct_writer_posix::reserve(size_t size)
+{
+	if(::fallocate64(m_fd, FALLOC_FL_KEEP_SIZE, static_cast<off64_t>(tell()), static_cast<off64_t>(size)) == -1 && errno != EOPNOTSUPP)
+	{
+		spdlog::debug("fallocate failed for descriptor {}: {} (errno={}) ", m_fd, strerror(errno), errno);
+	}
 }
@@ -3,8 +3,11 @@
 #include "xr_types.hxx"
 #include "xr_reader.hxx"
 #include "xr_writer.hxx"
+#include "xr_uring.hxx"
 
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace xray_re
@@ -22,6 +25,12 @@ namespace xray_re
 		enum
 		{
 			FSF_READ_ONLY = 0x1,
+			FSF_IO_URING = 0x2, // write_files() through io_uring, where the kernel allows it
+		};
+
+		enum
+		{
+			URING_ENTRIES = 128,
 		};
 
 		xr_file_system();
@@ -31,13 +40,23 @@ namespace xray_re
 
 		bool initialize(const std::string& fs_spec, unsigned flags = 0);
 		bool read_only() const;
+		bool io_uring() const;
 
 		static xr_reader* r_open(const std::string& path);
 		xr_reader* r_open(const std::string& path, const std::string& name) const;
 		static void r_close(xr_reader*& r);
 		xr_writer* w_open(const std::string& path, bool ignore_ro = false) const;
 		xr_writer* w_open(const std::string& path, const std::string& name, bool ignore_ro = false) const;
+		// opens a file that must exist for changing in place, nothing is truncated
+		xr_writer* w_open_existing(const std::string& path, bool ignore_ro = false) const;
+		// name is relative to the folder open as dirfd
+		xr_writer* w_open_at(int dirfd, const std::string& name, bool ignore_ro = false) const;
+		// writer that bypasses the page cache, nullptr if the file system doesn't support O_DIRECT
+		xr_writer* w_open_direct_at(int dirfd, const std::string& name, bool ignore_ro = false) const;
 		static void w_close(xr_writer*& w);
+		// writes each request as a whole file, missing parent folders of paths that
+		// don't start from a dirfd are created
+		void write_files(xr_write_request *requests, size_t count) const;
 
 		bool copy_file(const std::string& src_path, const std::string& src_name, const std::string& tgt_path, const std::string& tgt_name = nullptr) const;
 		bool copy_file(const std::string& src_path, const std::string& tgt_path) const;
@@ -46,6 +65,8 @@ namespace xray_re
 		static uint32_t file_age(const std::string& path);
 		static bool file_exist(const std::string& path);
 		static bool folder_exist(const std::string& path);
+		// appends the files matching a shell pattern in sorted order, false if no regular file matches
+		static bool expand_glob(const std::string& pattern, std::vector<std::string>& paths);
 		bool create_path(const std::string& path) const;
 		bool create_folder(const std::string& path) const;
 		const char* resolve_path(const std::string &path) const;
@@ -81,25 +102,151 @@ namespace xray_re
 		xr_mmap_reader_posix(int fd, void *data, size_t file_length, size_t mem_lenght);
 		virtual ~xr_mmap_reader_posix();
 
+		int fd() const;
+
 	private:
 		int m_fd;
 		size_t m_file_length;
 		size_t m_mem_length;
 	};
 
+	// Output folders created once, parents first, and kept open so that files are opened
+	// relative to them instead of resolving their whole path every time.
+	class xr_folder_cache
+	{
+	public:
+		xr_folder_cache();
+		~xr_folder_cache();
+
+		xr_folder_cache(const xr_folder_cache& that) = delete;
+		xr_folder_cache& operator=(const xr_folder_cache& right) = delete;
+
+		// folders are relative to root and separated with '/', missing parents are added
+		bool create(const std::string& root, std::vector<std::string> folders);
+		void close();
+
+		// descriptor of the folder, -1 if it is unknown or couldn't be kept open; at most a quarter of
+		// the descriptor limit is kept
+		int fd(std::string_view folder) const;
+		size_t size() const;
+
+	private:
+		int m_root_fd;
+		size_t m_open; // folder descriptors kept
+		std::vector<std::pair<std::string, int>> m_folders; // sorted by name
+	};
+
+	inline size_t xr_folder_cache::size() const { return m_folders.size(); }
+
+	// view of a part of a file, see xr_file_reader_posix::map()
+	class xr_mmap_window_posix: public xr_reader
+	{
+	public:
+		xr_mmap_window_posix(void *base, size_t mem_length, size_t delta, size_t length);
+		virtual ~xr_mmap_window_posix();
+
+	private:
+		void *m_base;
+		size_t m_mem_length;
+	};
+
+	// file read piecewise, for archives that must not be mapped as a whole
+	class xr_file_reader_posix
+	{
+	public:
+		xr_file_reader_posix();
+		~xr_file_reader_posix();
+
+		xr_file_reader_posix(const xr_file_reader_posix& that) = delete;
+		xr_file_reader_posix& operator=(const xr_file_reader_posix& right) = delete;
+
+		bool open(const std::string& path);
+		void close();
+
+		int fd() const;
+		size_t size() const;
+
+		bool r_raw(size_t offset, void *dest, size_t length) const;
+		// maps [offset, offset + length) only, release it with xr_file_system::r_close()
+		xr_reader* map(size_t offset, size_t length) const;
+
+	private:
+		int m_fd;
+		size_t m_size;
+	};
+
+	// Writes go through a user-space buffer, blobs at least as large as the buffer are gathered
+	// with it into a single writev(). The write position is tracked here, so tell() is free and
+	// patches of earlier bytes are made with pwrite() without moving it.
 	class xr_file_writer_posix: public xr_writer
 	{
 	public:
+		enum
+		{
+			DEFAULT_BUFFER_SIZE = 64 * 1024,
+		};
+
 		xr_file_writer_posix();
-		explicit xr_file_writer_posix(int fd);
+		explicit xr_file_writer_posix(int fd, size_t buffer_size = DEFAULT_BUFFER_SIZE);
 		virtual ~xr_file_writer_posix() override;
 		virtual void w_raw(const void *data, size_t length) override;
 		virtual void seek(size_t pos) override;
 		virtual size_t tell() override;
+		virtual void w_raw_at(size_t pos, const void *data, size_t length) override;
+		// preallocates the disk space, so that the file isn't extended write by write
+		virtual void reserve(size_t size) override;
+
+		// 0 disables buffering
+		void set_buffer_size(size_t buffer_size);
+		void flush();
+		// flushes and waits until the data written so far is on the disk
+		bool sync();
+
+		// copies length bytes at offset of fd without passing them through user space,
+		// false if the kernel can't do that here and nothing was written
+		bool w_copy(int fd, size_t offset, size_t length);
+
+	private:
+		void write_all(const void *head, size_t head_length, const void *tail, size_t tail_length);
+
+		int m_fd;
+		size_t m_pos;            // file offset of m_buffer[0]
+		size_t m_buffer_size;
+		std::vector<uint8_t> m_buffer; // allocated on the first buffered write
+	};
+
+	// Sequential writer for a file opened with O_DIRECT: data is staged in an aligned buffer and
+	// written in whole blocks, only the unaligned tail of the file goes through the page cache.
+	class xr_direct_writer_posix: public xr_writer
+	{
+	public:
+		enum
+		{
+			ALIGNMENT = 4096,
+			BUFFER_SIZE = 1024 * 1024,
+		};
+
+		explicit xr_direct_writer_posix(int fd);
+		virtual ~xr_direct_writer_posix() override;
+		virtual void w_raw(const void *data, size_t length) override;
+		virtual void seek(size_t pos) override;
+		virtual size_t tell() override;
+		virtual void reserve(size_t size) override;
+
+		bool is_open() const;
 
 	private:
+		void flush(bool tail);
+
 		int m_fd;
+		size_t m_pos;    // file offset of m_buffer[0]
+		size_t m_used;
+		uint8_t *m_buffer;
 	};
 
+	inline int xr_mmap_reader_posix::fd() const { return m_fd; }
+	inline int xr_file_reader_posix::fd() const { return m_fd; }
+	inline size_t xr_file_reader_posix::size() const { return m_size; }
+
 	static const std::string PA_FS_ROOT = "$fs_root$";
 }
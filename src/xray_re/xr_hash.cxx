@@ -0,0 +1,104 @@
+#include "xr_hash.hxx"
+
+#include <cstring>
+
+using namespace xray_re;
+
+namespace
+{
+	constexpr uint64_t PRIME64_1 = 0x9e3779b185ebca87ull;
+	constexpr uint64_t PRIME64_2 = 0xc2b2ae3d27d4eb4full;
+	constexpr uint64_t PRIME64_3 = 0x165667b19e3779f9ull;
+	constexpr uint64_t PRIME64_4 = 0x85ebca77c2b2ae63ull;
+	constexpr uint64_t PRIME64_5 = 0x27d4eb2f165667c5ull;
+
+	inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+	inline uint64_t read64(const uint8_t *p)
+	{
+		uint64_t value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint32_t read32(const uint8_t *p)
+	{
+		uint32_t value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint64_t round(uint64_t acc, uint64_t input)
+	{
+		acc += input * PRIME64_2;
+		acc = rotl(acc, 31);
+		return acc * PRIME64_1;
+	}
+
+	inline uint64_t merge_round(uint64_t acc, uint64_t value)
+	{
+		acc ^= round(0, value);
+		return acc * PRIME64_1 + PRIME64_4;
+	}
+}
+
+uint64_t xray_re::xr_hash64(const void *data, size_t size, uint64_t seed)
+{
+	auto p = static_cast<const uint8_t*>(data);
+	const uint8_t *end = p + size;
+	uint64_t h;
+
+	if(size >= 32)
+	{
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		for(const uint8_t *limit = end - 32; p <= limit; p += 32)
+		{
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	}
+	else
+	{
+		h = seed + PRIME64_5;
+	}
+
+	h += size;
+
+	for(; p + 8 <= end; p += 8)
+	{
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+
+	if(p + 4 <= end)
+	{
+		h ^= read32(p) * PRIME64_1;
+		h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	for(; p < end; ++p)
+	{
+		h ^= *p * PRIME64_5;
+		h = rotl(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
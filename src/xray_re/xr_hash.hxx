@@ -0,0 +1,10 @@
+#pragma once
+
+#include "xr_types.hxx"
+
+namespace xray_re
+{
+	// XXH64 of the buffer: a 64-bit non-cryptographic hash that runs at memory speed, used to
+	// find candidate duplicates before they are compared byte by byte
+	uint64_t xr_hash64(const void *data, size_t size, uint64_t seed = 0);
+}
@@ -12,6 +12,7 @@ All rights reserved. Permission granted for non-commercial use.
 
 #include "xr_lzhuf.hxx"
 
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 
@@ -543,16 +544,14 @@ int _lzhuf::DecodePosition()
 	return c | (i & 0x3f);
 }
 
-void _lzhuf::Encode(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize)
+void _lzhuf::Encode(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize, unsigned int level)
 {
-	int i, c, r, s, last_match_length;
-	uint32_t len;
-
 	m_src_limit = _textsize;
 	m_src_pos = 0;
 	m_src = _text;
 
-	m_dest_limit = _textsize/2;
+	// the output starts with the 4-byte text size, so tiny inputs still need room for it
+	m_dest_limit = std::max<uint32_t>(_textsize/2, 8);
 	m_dest_pos = 4;
 	m_dest = static_cast<uint8_t*>(malloc(m_dest_limit));
 	*(uint32_t*)m_dest = uint32_t(_textsize);
@@ -561,6 +560,26 @@ void _lzhuf::Encode(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text,
 	putlen = 0;
 
 	StartHuff();
+
+	if(level == LEVEL_REFERENCE)
+	{
+		EncodeTree();
+	}
+	else
+	{
+		EncodeHashChain(_text, _textsize, std::min<unsigned int>(level, LEVEL_BEST));
+	}
+
+	EncodeEnd();
+	_code = m_dest;
+	_codesize = m_dest_pos;
+}
+
+void _lzhuf::EncodeTree()
+{
+	int i, c, r, s, last_match_length;
+	uint32_t len;
+
 	InitTree();
 	s = 0;
 	r = N - F;
@@ -628,12 +647,152 @@ void _lzhuf::Encode(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text,
 		}
 	}
 	while (len > 0);
-	EncodeEnd();
-	_code = m_dest;
-	_codesize = m_dest_pos;
 }
 
-void _lzhuf::Decode(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code, uint32_t _codesize)
+// Hash chain match finder
+
+inline uint32_t _lzhuf::Hash(const uint8_t *p)
+{
+	// multiplicative hash of the THRESHOLD + 1 bytes a match needs at least
+	uint32_t value = uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16;
+	return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void _lzhuf::InsertHash(const uint8_t *text, uint32_t pos)
+{
+	uint32_t h = Hash(text + pos);
+	m_prev[pos & (N - 1)] = m_head[h];
+	m_head[h] = static_cast<int32_t>(pos);
+}
+
+_lzhuf::match_t _lzhuf::FindMatch(const uint8_t *text, uint32_t pos, uint32_t size, uint32_t max_chain, uint32_t nice_length) const
+{
+	match_t best = {0, 0};
+	uint32_t max_length = std::min<uint32_t>(F, size - pos);
+	if(max_length <= THRESHOLD)
+	{
+		return best;
+	}
+
+	// the decoder keeps N bytes of history, the tree encoder never looks further back than N - 1 either
+	int32_t limit = static_cast<int32_t>(pos) - (N - 1);
+	const uint8_t *current = text + pos;
+
+	for(int32_t candidate = m_head[Hash(current)]; candidate >= 0 && candidate >= limit && max_chain--;)
+	{
+		const uint8_t *p = text + candidate;
+		if(p[best.length] == current[best.length] && p[0] == current[0])
+		{
+			uint32_t length = 1;
+			while(length < max_length && p[length] == current[length])
+			{
+				length++;
+			}
+
+			if(length > best.length)
+			{
+				best.length = length;
+				best.distance = pos - static_cast<uint32_t>(candidate);
+				if(length >= nice_length || length == max_length)
+				{
+					break;
+				}
+			}
+		}
+
+		int32_t next = m_prev[candidate & (N - 1)];
+		if(next >= candidate)
+		{
+			break;
+		}
+		candidate = next;
+	}
+
+	if(best.length <= THRESHOLD)
+	{
+		best.length = 0;
+	}
+	return best;
+}
+
+void _lzhuf::EncodeHashChain(const uint8_t *text, uint32_t size, unsigned int level)
+{
+	struct level_params
+	{
+		uint32_t max_chain;
+		uint32_t nice_length;
+		bool lazy;
+	};
+
+	static const std::array<level_params, LEVEL_BEST + 1> params =
+	{{
+		{   0,  0, false},
+		{   4,  8, false},
+		{   8, 16, false},
+		{  16, 32, false},
+		{  32, 32, true },
+		{  64, 60, true },
+		{ 128, 60, true },
+		{ 256, 60, true },
+		{1024, 60, true },
+		{4096, 60, true },
+	}};
+
+	const level_params& param = params.at(level);
+
+	std::fill(std::begin(m_head), std::end(m_head), -1);
+
+	uint32_t pos = 0;
+	uint32_t inserted = 0; // every position below this one is on the chains
+	auto insert_until = [&](uint32_t end)
+	{
+		for(end = std::min(end, size >= THRESHOLD ? size - THRESHOLD : 0); inserted < end; inserted++)
+		{
+			InsertHash(text, inserted);
+		}
+	};
+
+	match_t next = {0, 0};
+	bool next_valid = false;
+	while(pos < size)
+	{
+		match_t match = next;
+		if(!next_valid)
+		{
+			insert_until(pos);
+			match = FindMatch(text, pos, size, param.max_chain, param.nice_length);
+		}
+		next_valid = false;
+
+		// lazy evaluation: emit a literal if the match at the next position is longer
+		if(param.lazy && match.length != 0 && match.length < param.nice_length && pos + 1 < size)
+		{
+			insert_until(pos + 1);
+			next = FindMatch(text, pos + 1, size, param.max_chain, param.nice_length);
+			if(next.length > match.length)
+			{
+				EncodeChar(text[pos]);
+				pos++;
+				next_valid = true;
+				continue;
+			}
+		}
+
+		if(match.length == 0)
+		{
+			EncodeChar(text[pos]);
+			pos++;
+		}
+		else
+		{
+			EncodeChar(static_cast<unsigned int>(255 - THRESHOLD + match.length));
+			EncodePosition(match.distance - 1);
+			pos += match.length;
+		}
+	}
+}
+
+void _lzhuf::DecodeBitwise(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code, uint32_t _codesize)
 {
 	int i, j, k, r, c;
 	uint32_t count;
@@ -686,6 +845,103 @@ void _lzhuf::Decode(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code,
 	_textsize = textsize;
 }
 
+// Same stream as DecodeBitwise, but the bits come from a 64-bit reservoir that is refilled
+// once per symbol. A symbol takes at most 35 bits: the adaptive tree is a Huffman tree over
+// at most MAX_FREQ occurrences, so it is never deeper than 21 levels, and a position code
+// is at most 14 bits. Positions are decoded with one peek and the d_code/d_len tables
+// instead of bit by bit, and matches are copied straight from the output buffer.
+void _lzhuf::Decode(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code, uint32_t _codesize)
+{
+	textsize = *(uint32_t*)_code;
+	uint8_t *dest = static_cast<uint8_t*>(malloc(textsize));
+
+	const uint8_t *src = _code + 4;
+	const uint8_t *src_end = _code + _codesize;
+
+	// the next unread bits of the stream, MSB first
+	uint64_t bitbuf = 0;
+	unsigned int bitcount = 0;
+
+	StartHuff();
+	for(int i = 0; i < N - F; i++)
+	{
+		text_buf[i] = ' ';
+	}
+
+	uint32_t count = 0;
+	while(count < textsize)
+	{
+		if(src_end - src >= 8)
+		{
+			uint64_t bytes;
+			std::memcpy(&bytes, src, sizeof(bytes));
+			bitbuf |= __builtin_bswap64(bytes) >> bitcount;
+			src += (63 - bitcount) >> 3;
+			bitcount |= 56;
+		}
+		else
+		{
+			// past the end of the stream GetBit() reads zeroes as well
+			for(; bitcount <= 56; bitcount += 8)
+			{
+				uint64_t byte = src < src_end ? *src++ : 0;
+				bitbuf |= byte << (56 - bitcount);
+			}
+		}
+
+		// travel from root to leaf like DecodeChar
+		int c = son[R];
+		unsigned int depth = 0;
+		while(c < T)
+		{
+			c = son[c + static_cast<int>(bitbuf >> 63)];
+			bitbuf <<= 1;
+			depth++;
+		}
+		bitcount -= depth;
+		c -= T;
+		update(c);
+
+		if(c < 256)
+		{
+			dest[count++] = static_cast<uint8_t>(c);
+			continue;
+		}
+
+		// upper 6 bits of the position come from the table, the lower 6 bits follow verbatim
+		auto byte = static_cast<unsigned int>(bitbuf >> 56);
+		unsigned int position_bits = d_len[byte] + 6u;
+		unsigned int position = (static_cast<unsigned int>(d_code[byte]) << 6) | static_cast<unsigned int>((bitbuf >> (64 - position_bits)) & 0x3f);
+		bitbuf <<= position_bits;
+		bitcount -= position_bits;
+
+		uint32_t distance = position + 1;
+		uint32_t length = std::min<uint32_t>(static_cast<uint32_t>(c - 255 + THRESHOLD), textsize - count);
+		uint8_t *out = dest + count;
+		if(distance <= count)
+		{
+			const uint8_t *from = out - distance;
+			for(uint32_t k = 0; k < length; k++)
+			{
+				out[k] = from[k];
+			}
+		}
+		else
+		{
+			// the match starts in the initial window, which precedes the output
+			for(uint32_t k = 0; k < length; k++)
+			{
+				int64_t from = int64_t(count + k) - distance;
+				out[k] = from >= 0 ? dest[from] : text_buf[(N - F + from) & (N - 1)];
+			}
+		}
+		count += length;
+	}
+
+	_text = dest;
+	_textsize = textsize;
+}
+
 int _lzhuf::getc()
 {
 	return m_src_pos < m_src_limit ? m_src[m_src_pos++] : -1;
@@ -704,8 +960,8 @@ void _lzhuf::putc(int c)
 	m_dest[m_dest_pos++] = static_cast<unsigned char>(c);
 }
 
-xr_lzhuf* xr_lzhuf::instance()
+_lzhuf& xr_lzhuf::context()
 {
-	static xr_lzhuf instance;
-	return &instance;
+	static thread_local _lzhuf context;
+	return context;
 }
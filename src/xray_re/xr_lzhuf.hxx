@@ -7,6 +7,9 @@
 
 namespace xray_re
 {
+	// LZHUF codec context: the sliding window, the adaptive Huffman tree and the bit buffers.
+	// A context is not thread-safe, but any number of contexts may run concurrently, so every
+	// thread or task that needs to (de)compress owns its own one and reuses it between calls.
 	class _lzhuf
 	{
 	private:
@@ -26,6 +29,18 @@ namespace xray_re
 			R = T - 1,
 		};
 
+		enum hash_chain_params
+		{
+			HASH_BITS = 13,
+			HASH_SIZE = 1 << HASH_BITS,
+		};
+
+		struct match_t
+		{
+			uint32_t length;
+			uint32_t distance;
+		};
+
 		unsigned char text_buf[N + F - 1];
 		int match_position, lson[N + 1], rson[N + 257], dad[N + 1];
 		uint32_t match_length;
@@ -33,6 +48,10 @@ namespace xray_re
 		int prnt[T + N_CHAR];
 		int son[T];
 
+		// hash chain match finder: last position for every 3-byte hash and links to older ones
+		int32_t m_head[HASH_SIZE];
+		int32_t m_prev[N];
+
 		uint32_t textsize;
 		uint8_t *m_dest;
 		uint32_t m_dest_pos;
@@ -58,6 +77,12 @@ namespace xray_re
 		void InsertNode(int r);
 		void DeleteNode(int p);
 
+		static uint32_t Hash(const uint8_t *p);
+		void InsertHash(const uint8_t *text, uint32_t pos);
+		match_t FindMatch(const uint8_t *text, uint32_t pos, uint32_t size, uint32_t max_chain, uint32_t nice_length) const;
+		void EncodeTree();
+		void EncodeHashChain(const uint8_t *text, uint32_t size, unsigned int level);
+
 		int GetBit();
 		int GetByte(void);
 		void Putcode(int l, unsigned int c);
@@ -75,40 +100,45 @@ namespace xray_re
 		void putc(int c);
 
 	public:
+		enum
+		{
+			LEVEL_REFERENCE = 0, // binary tree match finder of the original lzhuf.c
+			LEVEL_FASTEST   = 1,
+			LEVEL_BEST      = 9,
+		};
+
 		_lzhuf();
 		~_lzhuf();
 
-		void Encode(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize);
+		// Levels above LEVEL_REFERENCE use hash chains (with lazy matching from level 4), trading
+		// ratio for speed. Every level produces a regular LZHUF stream.
+		void Encode(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize, unsigned int level = LEVEL_REFERENCE);
 		void Decode(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code, uint32_t _codesize);
+
+		// reference decoder reading the stream one bit at a time; produces the same output as Decode
+		void DecodeBitwise(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code, uint32_t _codesize);
 	};
 
 	class xr_lzhuf
 	{
-	private:
-		_lzhuf m_lzhuf;
-		static xr_lzhuf* instance();
-
-	protected:
-		xr_lzhuf();
-		xr_lzhuf(const xr_lzhuf& that);
-		xr_lzhuf& operator=(const xr_lzhuf& right);
-
 	public:
-		static void	compress(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize);
+		// codec context owned by the calling thread
+		static _lzhuf& context();
+
+		static void	compress(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize, unsigned int level = _lzhuf::LEVEL_REFERENCE);
 		static void	decompress(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code, uint32_t _codesize);
 	};
 
 	inline _lzhuf::_lzhuf() {}
 	inline _lzhuf::~_lzhuf() {}
-	inline xr_lzhuf::xr_lzhuf() {}
 
-	inline void xr_lzhuf::compress(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize)
+	inline void xr_lzhuf::compress(uint8_t *&_code, uint32_t& _codesize, const uint8_t *_text, uint32_t _textsize, unsigned int level)
 	{
-		instance()->m_lzhuf.Encode(_code, _codesize, _text, _textsize);
+		context().Encode(_code, _codesize, _text, _textsize, level);
 	}
 
 	inline void xr_lzhuf::decompress(uint8_t *&_text, uint32_t& _textsize, const uint8_t *_code, uint32_t _codesize)
 	{
-		instance()->m_lzhuf.Decode(_text, _textsize, _code, _codesize);
+		context().Decode(_text, _textsize, _code, _codesize);
 	}
 }
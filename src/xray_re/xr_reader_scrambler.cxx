@@ -7,6 +7,8 @@
 
 #include <spdlog/spdlog.h>
 
+#include <vector>
+
 using namespace xray_re;
 
 xr_reader* xr_reader::open_chunk(uint32_t id, const xr_scrambler& scrambler)
@@ -23,12 +25,13 @@ xr_reader* xr_reader::open_chunk(uint32_t id, const xr_scrambler& scrambler)
 
 	if(compressed)
 	{
-		auto temp = new uint8_t[size];
-		scrambler.decrypt(temp, m_p, size);
+		// decryption buffer is kept per thread, so reopening headers doesn't reallocate it every time
+		static thread_local std::vector<uint8_t> temp;
+		temp.resize(size);
+		scrambler.decrypt(temp.data(), m_p, size);
 		uint8_t* data;
 		uint32_t real_size;
-		xr_lzhuf::decompress(data, real_size, temp, size);
-		delete[] temp;
+		xr_lzhuf::decompress(data, real_size, temp.data(), static_cast<uint32_t>(size));
 		return new xr_temp_reader(data, real_size);
 	}
 	else
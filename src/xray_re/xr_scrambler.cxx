@@ -1,20 +1,53 @@
 #include "xr_scrambler.hxx"
 
+#include <algorithm>
 #include <utility>
 #include <numeric>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SCRAMBLER_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define SCRAMBLER_HAVE_AVX2 0
+#endif
+
 using namespace xray_re;
 
-const int SEED_MULT = 0x8088405;
+const uint32_t SEED_MULT = 0x8088405;
 
-const int SEED_RU = 0x131a9d3;
-const int SEED0_RU = 0x1329436;
+const uint32_t SEED_RU = 0x131a9d3;
+const uint32_t SEED0_RU = 0x1329436;
 const int SIZE_MULT_RU = 8;
 
-const int SEED_WW = 0x16eb2eb;
-const int SEED0_WW = 0x5bbc4b;
+const uint32_t SEED_WW = 0x16eb2eb;
+const uint32_t SEED0_WW = 0x5bbc4b;
 const int SIZE_MULT_WW = 4;
 
+// The keystream byte is the top byte of the LCG state seed = 1 + seed*SEED_MULT (mod 2^32).
+// n steps of it are again an LCG, seed = add + seed*mult, which lets the keystream be
+// generated several bytes apart in parallel.
+struct lcg_jump
+{
+	uint32_t mult;
+	uint32_t add;
+};
+
+static constexpr lcg_jump make_jump(unsigned int steps)
+{
+	lcg_jump jump = {1, 0};
+	for(unsigned int i = 0; i < steps; i++)
+	{
+		jump.mult *= SEED_MULT;
+		jump.add = jump.add*SEED_MULT + 1;
+	}
+	return jump;
+}
+
+static inline uint32_t step(uint32_t seed)
+{
+	return 1 + seed*SEED_MULT;
+}
+
 void xr_scrambler::init(cipher_config cc)
 {
 	if(cc == CC_RU)
@@ -29,18 +62,18 @@ void xr_scrambler::init(cipher_config cc)
 	}
 }
 
-void xr_scrambler::init_sboxes(int seed, std::size_t size_mult)
+void xr_scrambler::init_sboxes(uint32_t seed, std::size_t size_mult)
 {
 	std::iota(m_enc_sbox.begin(), m_enc_sbox.end(), 0);
 
 	for (std::size_t a, b, i = size_mult*SBOX_SIZE; i > 0; --i)
 	{
-		seed = 1 + seed * SEED_MULT;
+		seed = step(seed);
 		a = (seed >> 24) & 0xff;
 
 		do
 		{
-			seed = 1 + seed * SEED_MULT;
+			seed = step(seed);
 			b = (seed >> 24) & 0xff;
 		}
 		while (a == b);
@@ -54,22 +87,189 @@ void xr_scrambler::init_sboxes(int seed, std::size_t size_mult)
 	}
 }
 
-void xr_scrambler::decrypt(uint8_t *dest, const uint8_t *src, size_t size) const
+// Fills dest with the keystream following seed, four interleaved LCG lanes at a time.
+static void keystream_block(uint32_t seed, uint8_t *dest, size_t size)
 {
-	int seed = m_seed;
-	for (size_t i = 0; i != size; ++i)
+	constexpr lcg_jump jump4 = make_jump(4);
+
+	uint32_t s0 = step(seed);
+	uint32_t s1 = step(s0);
+	uint32_t s2 = step(s1);
+	uint32_t s3 = step(s2);
+
+	size_t i = 0;
+	for(; i + 4 <= size; i += 4)
+	{
+		dest[i + 0] = uint8_t(s0 >> 24);
+		dest[i + 1] = uint8_t(s1 >> 24);
+		dest[i + 2] = uint8_t(s2 >> 24);
+		dest[i + 3] = uint8_t(s3 >> 24);
+
+		s0 = jump4.add + s0*jump4.mult;
+		s1 = jump4.add + s1*jump4.mult;
+		s2 = jump4.add + s2*jump4.mult;
+		s3 = jump4.add + s3*jump4.mult;
+	}
+
+	for(; i < size; i++, s0 = step(s0))
 	{
-		seed = 1 + seed * SEED_MULT;
-		dest[i] = m_dec_sbox.at(src[i] ^ ((seed >> 24) & 0xff));
+		dest[i] = uint8_t(s0 >> 24);
 	}
 }
 
+#if SCRAMBLER_HAVE_AVX2
+// Same as keystream_block, 32 bytes per iteration: four vectors of eight consecutive LCG
+// states, their top bytes packed down and put back in order.
+__attribute__((target("avx2")))
+static void keystream_avx2(uint32_t seed, uint8_t *dest, size_t size)
+{
+	constexpr lcg_jump jump8 = make_jump(8);
+	constexpr lcg_jump jump32 = make_jump(32);
+
+	alignas(32) uint32_t lanes[8];
+	for(auto& lane : lanes)
+	{
+		lane = seed = step(seed);
+	}
+
+	const __m256i mult8 = _mm256_set1_epi32(static_cast<int>(jump8.mult));
+	const __m256i add8 = _mm256_set1_epi32(static_cast<int>(jump8.add));
+	const __m256i mult32 = _mm256_set1_epi32(static_cast<int>(jump32.mult));
+	const __m256i add32 = _mm256_set1_epi32(static_cast<int>(jump32.add));
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	__m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes));
+	__m256i b = _mm256_add_epi32(_mm256_mullo_epi32(a, mult8), add8);
+	__m256i c = _mm256_add_epi32(_mm256_mullo_epi32(b, mult8), add8);
+	__m256i d = _mm256_add_epi32(_mm256_mullo_epi32(c, mult8), add8);
+
+	size_t i = 0;
+	for(; i + 32 <= size; i += 32)
+	{
+		__m256i ab = _mm256_packus_epi32(_mm256_srli_epi32(a, 24), _mm256_srli_epi32(b, 24));
+		__m256i cd = _mm256_packus_epi32(_mm256_srli_epi32(c, 24), _mm256_srli_epi32(d, 24));
+		__m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ab, cd), order);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), bytes);
+
+		a = _mm256_add_epi32(_mm256_mullo_epi32(a, mult32), add32);
+		b = _mm256_add_epi32(_mm256_mullo_epi32(b, mult32), add32);
+		c = _mm256_add_epi32(_mm256_mullo_epi32(c, mult32), add32);
+		d = _mm256_add_epi32(_mm256_mullo_epi32(d, mult32), add32);
+	}
+
+	if(i < size)
+	{
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), a);
+		// the first lane of a holds the state of byte i, finish the tail one step at a time
+		uint32_t state = lanes[0];
+		for(; i < size; i++, state = step(state))
+		{
+			dest[i] = uint8_t(state >> 24);
+		}
+	}
+}
+#endif
+
+bool xr_scrambler::supported(implementation impl)
+{
+	switch(impl)
+	{
+		case IMPL_BYTEWISE:
+		case IMPL_BLOCK:
+			return true;
+		case IMPL_AVX2:
+#if SCRAMBLER_HAVE_AVX2
+			return __builtin_cpu_supports("avx2");
+#else
+			return false;
+#endif
+	}
+
+	return false;
+}
+
+xr_scrambler::implementation xr_scrambler::best_implementation()
+{
+	static const implementation best = supported(IMPL_AVX2) ? IMPL_AVX2 : IMPL_BLOCK;
+	return best;
+}
+
+void xr_scrambler::keystream(implementation impl, uint32_t seed, uint8_t *dest, size_t size)
+{
+#if SCRAMBLER_HAVE_AVX2
+	if(impl == IMPL_AVX2)
+	{
+		keystream_avx2(seed, dest, size);
+		return;
+	}
+#endif
+	keystream_block(seed, dest, size);
+}
+
+void xr_scrambler::decrypt(uint8_t *dest, const uint8_t *src, size_t size) const
+{
+	decrypt(dest, src, size, best_implementation());
+}
+
 void xr_scrambler::encrypt(uint8_t *dest, const uint8_t *src, size_t size) const
 {
-	int seed = m_seed;
-	for (size_t i = 0; i != size; ++i)
+	encrypt(dest, src, size, best_implementation());
+}
+
+void xr_scrambler::decrypt(uint8_t *dest, const uint8_t *src, size_t size, implementation impl) const
+{
+	uint32_t seed = m_seed;
+
+	if(impl == IMPL_BYTEWISE)
+	{
+		for (size_t i = 0; i != size; ++i)
+		{
+			seed = step(seed);
+			dest[i] = m_dec_sbox[src[i] ^ ((seed >> 24) & 0xff)];
+		}
+		return;
+	}
+
+	constexpr lcg_jump jump_block = make_jump(BLOCK_SIZE);
+	alignas(32) uint8_t stream[BLOCK_SIZE];
+
+	for(size_t pos = 0; pos < size; pos += BLOCK_SIZE, seed = jump_block.add + seed*jump_block.mult)
+	{
+		size_t block = std::min<size_t>(BLOCK_SIZE, size - pos);
+		keystream(impl, seed, stream, block);
+
+		for(size_t i = 0; i < block; i++)
+		{
+			dest[pos + i] = m_dec_sbox[src[pos + i] ^ stream[i]];
+		}
+	}
+}
+
+void xr_scrambler::encrypt(uint8_t *dest, const uint8_t *src, size_t size, implementation impl) const
+{
+	uint32_t seed = m_seed;
+
+	if(impl == IMPL_BYTEWISE)
+	{
+		for (size_t i = 0; i != size; ++i)
+		{
+			seed = step(seed);
+			dest[i] = uint8_t(m_enc_sbox[src[i]] ^ ((seed >> 24) & 0xff));
+		}
+		return;
+	}
+
+	constexpr lcg_jump jump_block = make_jump(BLOCK_SIZE);
+	alignas(32) uint8_t stream[BLOCK_SIZE];
+
+	for(size_t pos = 0; pos < size; pos += BLOCK_SIZE, seed = jump_block.add + seed*jump_block.mult)
 	{
-		seed = 1 + seed * SEED_MULT;
-		dest[i] = uint8_t(m_enc_sbox.at(src[i]) ^ ((seed >> 24) & 0xff));
+		size_t block = std::min<size_t>(BLOCK_SIZE, size - pos);
+		keystream(impl, seed, stream, block);
+
+		for(size_t i = 0; i < block; i++)
+		{
+			dest[pos + i] = uint8_t(m_enc_sbox[src[pos + i]] ^ stream[i]);
+		}
 	}
 }
@@ -15,6 +15,14 @@ namespace xray_re
 			CC_WW,
 		};
 
+		// all implementations produce the same bytes
+		enum implementation
+		{
+			IMPL_BYTEWISE, // one LCG step per byte
+			IMPL_BLOCK,    // keystream generated in blocks using LCG jump-ahead
+			IMPL_AVX2,     // IMPL_BLOCK with an AVX2 keystream generator, checked at run time
+		};
+
 		xr_scrambler();
 		xr_scrambler(cipher_config cc);
 
@@ -22,15 +30,23 @@ namespace xray_re
 		void encrypt(uint8_t *dest, const uint8_t *src, size_t size) const;
 		void decrypt(uint8_t *dest, const uint8_t *src, size_t size) const;
 
+		static bool supported(implementation impl);
+		void encrypt(uint8_t *dest, const uint8_t *src, size_t size, implementation impl) const;
+		void decrypt(uint8_t *dest, const uint8_t *src, size_t size, implementation impl) const;
+
 	private:
 		enum
 		{
-			SBOX_SIZE = 256
+			SBOX_SIZE = 256,
+			BLOCK_SIZE = 4096,
 		};
 
-		void init_sboxes(int seed0, std::size_t size_mult);
+		void init_sboxes(uint32_t seed0, std::size_t size_mult);
+
+		static implementation best_implementation();
+		static void keystream(implementation impl, uint32_t seed, uint8_t *dest, size_t size);
 
-		int m_seed;
+		uint32_t m_seed;
 		std::array<uint8_t, SBOX_SIZE> m_enc_sbox;
 		std::array<uint8_t, SBOX_SIZE> m_dec_sbox;
 	};
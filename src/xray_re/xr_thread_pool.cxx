@@ -0,0 +1,68 @@
+#include "xr_thread_pool.hxx"
+
+using namespace xray_re;
+
+xr_thread_pool::xr_thread_pool(unsigned int threads): m_stop(false)
+{
+	threads = resolve_threads(threads);
+
+	m_threads.reserve(threads);
+	for(unsigned int i = 0; i < threads; ++i)
+	{
+		m_threads.emplace_back(&xr_thread_pool::worker, this);
+	}
+}
+
+xr_thread_pool::~xr_thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+
+	for(auto& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+unsigned int xr_thread_pool::resolve_threads(unsigned int threads)
+{
+	if(threads == 0)
+	{
+		threads = std::thread::hardware_concurrency();
+	}
+
+	return threads == 0 ? 1 : threads;
+}
+
+void xr_thread_pool::enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push(std::move(task));
+	}
+	m_cv.notify_one();
+}
+
+void xr_thread_pool::worker()
+{
+	while(true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+
+			if(m_tasks.empty())
+			{
+				return;
+			}
+
+			task = std::move(m_tasks.front());
+			m_tasks.pop();
+		}
+		task();
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "xr_types.hxx"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace xray_re
+{
+	class xr_thread_pool
+	{
+	public:
+		explicit xr_thread_pool(unsigned int threads);
+		~xr_thread_pool();
+
+		xr_thread_pool(const xr_thread_pool& that) = delete;
+		xr_thread_pool& operator=(const xr_thread_pool& right) = delete;
+
+		unsigned int size() const;
+
+		template<typename F> auto submit(F&& task) -> std::future<decltype(task())>;
+
+		// calls func(i) for every i in [0, count) on all workers and waits for completion
+		template<typename F> void parallel_for(size_t count, F func);
+
+		// 0 means "as many as the hardware supports"
+		static unsigned int resolve_threads(unsigned int threads);
+
+	private:
+		void enqueue(std::function<void()> task);
+		void worker();
+
+		std::vector<std::thread> m_threads;
+		std::queue<std::function<void()>> m_tasks;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_stop;
+	};
+
+	inline unsigned int xr_thread_pool::size() const { return static_cast<unsigned int>(m_threads.size()); }
+
+	template<typename F> inline auto xr_thread_pool::submit(F&& task) -> std::future<decltype(task())>
+	{
+		using result_type = decltype(task());
+		auto packaged = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(task));
+		std::future<result_type> result = packaged->get_future();
+		enqueue([packaged]() { (*packaged)(); });
+		return result;
+	}
+
+	template<typename F> inline void xr_thread_pool::parallel_for(size_t count, F func)
+	{
+		std::atomic<size_t> next{0};
+		std::vector<std::future<void>> workers;
+		workers.reserve(size());
+
+		for(unsigned int i = 0; i < size(); ++i)
+		{
+			workers.push_back(submit([&next, &func, count]()
+			{
+				for(size_t index; (index = next++) < count;)
+				{
+					func(index);
+				}
+			}));
+		}
+
+		for(auto& w : workers)
+		{
+			w.get();
+		}
+	}
+}
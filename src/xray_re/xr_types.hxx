@@ -6,12 +6,22 @@
 #include <stddef.h>
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstdarg>
 #include <cstddef>
 #include <cassert>
 
 constexpr const uint32_t BAD_IDX = UINT32_MAX;
 
+namespace xray_re
+{
+	[[noreturn]] inline void die(const char *message, const char *file, unsigned line)
+	{
+		std::fprintf(stderr, "%s at %s:%u\n", message, file, line);
+		std::abort();
+	}
+}
+
 #ifdef NDEBUG
 #define xr_assert(expr)		while (!(expr)) { xray_re::die("assertion failed", __FILE__, __LINE__); break; }
 #define xr_not_implemented()	xray_re::die("unimplemented code path", __FILE__, __LINE__)
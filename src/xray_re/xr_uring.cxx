@@ -0,0 +1,409 @@
+#include "xr_uring.hxx"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define XR_HAVE_IO_URING 1
+#else
+#define XR_HAVE_IO_URING 0
+#endif
+
+using namespace xray_re;
+
+#if XR_HAVE_IO_URING
+
+enum
+{
+	TAG_WRITE = 0,
+	TAG_CLOSE = 1,
+	TAG_FALLOCATE = 2,
+	TAG_BITS = 2,
+
+	// smaller files are written by a single request anyway
+	PREALLOCATE_SIZE = 64 * 1024,
+};
+
+static inline unsigned int load_acquire(const unsigned int *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void store_release(unsigned int *p, unsigned int value) { __atomic_store_n(p, value, __ATOMIC_RELEASE); }
+
+xr_uring::xr_uring(unsigned int entries) :
+    m_fd(-1), m_entries(0), m_sq_ring(MAP_FAILED), m_sq_ring_size(0), m_cq_ring(MAP_FAILED), m_cq_ring_size(0),
+    m_sqes(nullptr), m_sqes_size(0), m_cqes(nullptr), m_sq_head(nullptr), m_sq_tail(nullptr), m_sq_mask(nullptr),
+    m_sq_array(nullptr), m_cq_head(nullptr), m_cq_tail(nullptr), m_cq_mask(nullptr), m_sq_local_tail(0), m_sq_submitted(0)
+{
+	io_uring_params params {};
+	int fd = static_cast<int>(syscall(__NR_io_uring_setup, std::max(entries, 2u), &params));
+	if(fd == -1)
+	{
+		spdlog::debug("io_uring_setup failed: {} (errno={}) ", strerror(errno), errno);
+		return;
+	}
+
+	m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+	}
+
+	m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(m_sq_ring != MAP_FAILED)
+	{
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			m_cq_ring = m_sq_ring;
+		}
+		else
+		{
+			m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		}
+	}
+
+	m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = MAP_FAILED;
+	if(m_cq_ring != MAP_FAILED)
+	{
+		sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	}
+
+	m_fd = fd;
+	if(sqes == MAP_FAILED)
+	{
+		spdlog::debug("mmap of the io_uring rings failed: {} (errno={}) ", strerror(errno), errno);
+		destroy();
+		return;
+	}
+
+	auto sq = static_cast<uint8_t*>(m_sq_ring);
+	auto cq = static_cast<uint8_t*>(m_cq_ring);
+
+	m_sqes = static_cast<io_uring_sqe*>(sqes);
+	m_sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+	m_sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+	m_sq_mask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+	m_sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+	m_cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+	m_cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+	m_cq_mask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+	m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	m_entries = params.sq_entries;
+	m_sq_local_tail = m_sq_submitted = *m_sq_tail;
+}
+
+xr_uring::~xr_uring()
+{
+	destroy();
+}
+
+// unmaps whatever did get mapped, the ring is closed afterwards
+void xr_uring::destroy()
+{
+	if(m_sqes != nullptr)
+	{
+		munmap(m_sqes, m_sqes_size);
+		m_sqes = nullptr;
+	}
+
+	if(m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+	{
+		munmap(m_cq_ring, m_cq_ring_size);
+	}
+	m_cq_ring = MAP_FAILED;
+
+	if(m_sq_ring != MAP_FAILED)
+	{
+		munmap(m_sq_ring, m_sq_ring_size);
+		m_sq_ring = MAP_FAILED;
+	}
+
+	if(m_fd != -1)
+	{
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
+
+bool xr_uring::supported()
+{
+	static const bool result = []
+	{
+		xr_uring ring(2);
+		return ring.is_open();
+	}();
+
+	return result;
+}
+
+io_uring_sqe* xr_uring::get_sqe()
+{
+	if(m_sq_local_tail - load_acquire(m_sq_head) >= m_entries)
+	{
+		return nullptr;
+	}
+
+	unsigned int index = m_sq_local_tail & *m_sq_mask;
+	io_uring_sqe *sqe = &m_sqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	m_sq_array[index] = index;
+	++m_sq_local_tail;
+	return sqe;
+}
+
+bool xr_uring::submit(unsigned int wait_nr)
+{
+	store_release(m_sq_tail, m_sq_local_tail);
+
+	do
+	{
+		unsigned int to_submit = m_sq_local_tail - m_sq_submitted;
+		auto res = syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		if(res == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			spdlog::error("io_uring_enter failed: {} (errno={}) ", strerror(errno), errno);
+			return false;
+		}
+
+		m_sq_submitted += static_cast<unsigned int>(res);
+		wait_nr = 0;
+	}
+	while(m_sq_submitted != m_sq_local_tail);
+
+	return true;
+}
+
+bool xr_uring::reap(uint64_t& user_data, int& res)
+{
+	unsigned int head = *m_cq_head;
+	while(head == load_acquire(m_cq_tail))
+	{
+		if(!submit(1))
+		{
+			return false;
+		}
+	}
+
+	const io_uring_cqe& cqe = m_cqes[head & *m_cq_mask];
+	user_data = cqe.user_data;
+	res = cqe.res;
+	store_release(m_cq_head, head + 1);
+	return true;
+}
+
+void xr_uring::write_files(xr_write_request *requests, size_t count)
+{
+	if(!is_open())
+	{
+		std::for_each(requests, requests + count, [](xr_write_request& r) { r.error = ENOSYS; });
+		return;
+	}
+
+	std::vector<int> fds;
+	std::vector<size_t> written;
+	std::vector<bool> closing; // the ring owns the descriptor until its close completes
+
+	// every file takes one entry to open, then up to three to preallocate, write and close
+	size_t batch = std::max(m_entries / 3, 1u);
+	for(size_t start = 0; start < count; start += batch)
+	{
+		xr_write_request *r = requests + start;
+		size_t n = std::min(batch, count - start);
+
+		fds.assign(n, -1);
+		written.assign(n, 0);
+		closing.assign(n, false);
+
+		for(size_t i = 0; i < n; ++i)
+		{
+			io_uring_sqe *sqe = get_sqe();
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = r[i].dirfd;
+			sqe->addr = reinterpret_cast<uint64_t>(r[i].path.c_str());
+			sqe->len = 0666;
+			sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+			sqe->user_data = i;
+		}
+
+		bool ok = submit(static_cast<unsigned int>(n));
+		for(size_t i = 0; ok && i < n; ++i)
+		{
+			uint64_t user_data;
+			int res;
+			if(!(ok = reap(user_data, res)))
+			{
+				break;
+			}
+
+			fds[user_data] = res < 0 ? -1 : res;
+			r[user_data].error = res < 0 ? -res : 0;
+		}
+
+		unsigned int queued = 0;
+		for(size_t i = 0; ok && i < n; ++i)
+		{
+			if(fds[i] == -1)
+			{
+				continue;
+			}
+
+			if(r[i].size >= PREALLOCATE_SIZE)
+			{
+				io_uring_sqe *sqe = get_sqe();
+				sqe->opcode = IORING_OP_FALLOCATE;
+				sqe->fd = fds[i];
+				sqe->off = 0;
+				sqe->addr = r[i].size;
+				sqe->len = FALLOC_FL_KEEP_SIZE;
+				sqe->flags = IOSQE_IO_LINK;
+				sqe->user_data = (i << TAG_BITS) | TAG_FALLOCATE;
+				++queued;
+			}
+
+			if(r[i].size != 0)
+			{
+				io_uring_sqe *sqe = get_sqe();
+				sqe->opcode = IORING_OP_WRITE;
+				sqe->fd = fds[i];
+				sqe->addr = reinterpret_cast<uint64_t>(r[i].data);
+				sqe->len = static_cast<uint32_t>(std::min<size_t>(r[i].size, UINT32_MAX));
+				sqe->off = 0;
+				// a failed or short write cancels the close, the file is then finished below;
+				// so does a failed fallocate, which also cancels the write
+				sqe->flags = IOSQE_IO_LINK;
+				sqe->user_data = (i << TAG_BITS) | TAG_WRITE;
+				++queued;
+			}
+
+			io_uring_sqe *sqe = get_sqe();
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = fds[i];
+			sqe->user_data = (i << TAG_BITS) | TAG_CLOSE;
+			closing[i] = true;
+			++queued;
+		}
+
+		ok = ok && submit(queued);
+		for(unsigned int i = 0; ok && i < queued; ++i)
+		{
+			uint64_t user_data;
+			int res;
+			if(!(ok = reap(user_data, res)))
+			{
+				break;
+			}
+
+			size_t index = user_data >> TAG_BITS;
+			unsigned int tag = user_data & ((1 << TAG_BITS) - 1);
+			if(tag == TAG_FALLOCATE)
+			{
+				continue;
+			}
+
+			if(tag == TAG_WRITE)
+			{
+				if(res >= 0)
+				{
+					written[index] = static_cast<size_t>(res);
+				}
+				else if(res != -ECANCELED)
+				{
+					r[index].error = -res;
+				}
+			}
+			else if(res == -ECANCELED)
+			{
+				closing[index] = false;
+			}
+			else
+			{
+				closing[index] = false;
+				fds[index] = -1;
+				if(res < 0 && r[index].error == 0)
+				{
+					r[index].error = -res;
+				}
+			}
+		}
+
+		if(!ok)
+		{
+			// the ring is unusable: closing it settles whatever is still in flight,
+			// the caller redoes this batch and everything after it
+			destroy();
+			std::for_each(r, requests + count, [](xr_write_request& request) { request.error = EIO; });
+		}
+
+		// files the ring left open got a short or failed write, or the ring broke down
+		for(size_t i = 0; i < n; ++i)
+		{
+			// a close still in flight when the ring broke may have run already and the number
+			// been reused by another thread, so it is never closed again here
+			if(fds[i] == -1 || closing[i])
+			{
+				continue;
+			}
+
+			while(ok && r[i].error == 0 && written[i] < r[i].size)
+			{
+				auto res = ::pwrite64(fds[i], static_cast<const uint8_t*>(r[i].data) + written[i], r[i].size - written[i], static_cast<off64_t>(written[i]));
+				if(res == -1 && errno == EINTR)
+				{
+					continue;
+				}
+
+				if(res <= 0)
+				{
+					r[i].error = res == 0 ? EIO : errno;
+					break;
+				}
+
+				written[i] += static_cast<size_t>(res);
+			}
+
+			::close(fds[i]);
+		}
+
+		if(!ok)
+		{
+			return;
+		}
+	}
+}
+
+#else
+
+xr_uring::xr_uring(unsigned int) :
+    m_fd(-1), m_entries(0), m_sq_ring(nullptr), m_sq_ring_size(0), m_cq_ring(nullptr), m_cq_ring_size(0),
+    m_sqes(nullptr), m_sqes_size(0), m_cqes(nullptr), m_sq_head(nullptr), m_sq_tail(nullptr), m_sq_mask(nullptr),
+    m_sq_array(nullptr), m_cq_head(nullptr), m_cq_tail(nullptr), m_cq_mask(nullptr), m_sq_local_tail(0), m_sq_submitted(0) {}
+
+xr_uring::~xr_uring() = default;
+
+void xr_uring::destroy() {}
+
+bool xr_uring::supported() { return false; }
+
+void xr_uring::write_files(xr_write_request *requests, size_t count)
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		requests[i].error = ENOSYS;
+	}
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "xr_types.hxx"
+
+#include <string>
+#include <fcntl.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace xray_re
+{
+	struct xr_write_request
+	{
+		std::string path;
+		const void *data;
+		size_t size;
+		int error; // errno of the step that failed, 0 once the file is written
+		int dirfd = AT_FDCWD; // folder a relative path starts from
+	};
+
+	// io_uring instance driven through raw syscalls. It writes whole files in batches: the opens
+	// of a batch are submitted together, then every write is linked to the close of its file, so
+	// a batch costs two io_uring_enter() calls instead of three syscalls per file.
+	class xr_uring
+	{
+	public:
+		explicit xr_uring(unsigned int entries);
+		~xr_uring();
+
+		xr_uring(const xr_uring& that) = delete;
+		xr_uring& operator=(const xr_uring& right) = delete;
+
+		bool is_open() const;
+		unsigned int entries() const;
+
+		// false if the kernel lacks io_uring or the sandbox forbids it
+		static bool supported();
+
+		// requests that fail are left with error set, the caller redoes them with blocking I/O
+		void write_files(xr_write_request *requests, size_t count);
+
+	private:
+		void destroy();
+		io_uring_sqe* get_sqe();
+		bool submit(unsigned int wait_nr);
+		bool reap(uint64_t& user_data, int& res);
+
+		int m_fd;
+		unsigned int m_entries;
+
+		void *m_sq_ring;
+		size_t m_sq_ring_size;
+		void *m_cq_ring;
+		size_t m_cq_ring_size;
+		io_uring_sqe *m_sqes;
+		size_t m_sqes_size;
+		io_uring_cqe *m_cqes;
+
+		unsigned int *m_sq_head;
+		unsigned int *m_sq_tail;
+		unsigned int *m_sq_mask;
+		unsigned int *m_sq_array;
+		unsigned int *m_cq_head;
+		unsigned int *m_cq_tail;
+		unsigned int *m_cq_mask;
+
+		unsigned int m_sq_local_tail;
+		unsigned int m_sq_submitted;
+	};
+
+	inline bool xr_uring::is_open() const { return m_fd != -1; }
+	inline unsigned int xr_uring::entries() const { return m_entries; }
+}
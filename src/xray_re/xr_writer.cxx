@@ -28,12 +28,21 @@ void xr_writer::close_chunk()
 	size_t chunk_pos = m_open_chunks.top();
 	xr_assert(chunk_pos <= pos);
 
-	seek(chunk_pos - 4);
-	w_size_u32(pos - chunk_pos);
-	seek(pos);
+	auto size = static_cast<uint32_t>((pos - chunk_pos) & UINT32_MAX);
+	w_raw_at(chunk_pos - 4, &size, sizeof(size));
 	m_open_chunks.pop();
 }
 
+void xr_writer::reserve(size_t) {}
+
+void xr_writer::w_raw_at(size_t pos, const void *data, size_t size)
+{
+	size_t current = tell();
+	seek(pos);
+	w_raw(data, size);
+	seek(current);
+}
+
 void xr_writer::w_raw_chunk(uint32_t id, const void *data, size_t size)
 {
 	spdlog::debug("xr_writer::w_raw_chunk chunk_id={} compressed={}", id & ~CHUNK_COMPRESSED, (id & CHUNK_COMPRESSED) != 0);
@@ -114,6 +123,11 @@ size_t xr_memory_writer::tell()
 	return m_pos;
 }
 
+void xr_memory_writer::reserve(size_t size)
+{
+	m_buffer.reserve(m_pos + size);
+}
+
 bool xr_memory_writer::save_to(const char *path, const std::string& name)
 {
 	xr_file_system& fs = xr_file_system::instance();
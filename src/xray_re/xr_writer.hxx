@@ -20,6 +20,10 @@ namespace xray_re
 		virtual void w_raw(const void *data, size_t size) = 0;
 		virtual void seek(size_t pos) = 0;
 		virtual size_t tell() = 0;
+		// overwrites already written bytes at pos, the write position stays where it was
+		virtual void w_raw_at(size_t pos, const void *data, size_t size);
+		// hint that size more bytes are about to be written
+		virtual void reserve(size_t size);
 
 		void open_chunk(uint32_t id);
 		void close_chunk();
@@ -95,6 +99,7 @@ namespace xray_re
 		virtual void w_raw(const void *data, size_t size);
 		virtual void seek(size_t pos);
 		virtual size_t tell();
+		virtual void reserve(size_t size);
 
 		const uint8_t* data() const;
 
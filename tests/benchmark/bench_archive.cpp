@@ -0,0 +1,158 @@
+#include "bench_data.hxx"
+#include "db_tools.hxx"
+
+#include <benchmark/benchmark.h>
+#include <spdlog/spdlog.h>
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <tuple>
+
+namespace fs = std::filesystem;
+
+// Synthetic trees and their archives, made once per size and removed at exit.
+class SyntheticData
+{
+public:
+	~SyntheticData()
+	{
+		std::error_code error;
+		fs::remove_all(m_root, error);
+	}
+
+	static SyntheticData& instance()
+	{
+		static SyntheticData data;
+		return data;
+	}
+
+	fs::path tree(size_t files, size_t file_size)
+	{
+		fs::path path = m_root / ("tree_" + std::to_string(files) + "_" + std::to_string(file_size));
+		if(!fs::exists(path))
+		{
+			MakeTree(path, files, file_size);
+		}
+		return path;
+	}
+
+	std::string archive(size_t files, size_t file_size, db_tools::db_version version)
+	{
+		std::string path = (m_root / ("archive_" + std::to_string(files) + "_" + std::to_string(file_size) + "_" + std::to_string(version) + ".db")).string();
+		if(!fs::exists(path))
+		{
+			db_packer packer;
+			packer.process(tree(files, file_size).string() + "/", path, version, "");
+		}
+		return path;
+	}
+
+	fs::path scratch(const std::string& name) const
+	{
+		return m_root / name;
+	}
+
+private:
+	SyntheticData(): m_root(fs::temp_directory_path() / "db_bench")
+	{
+		spdlog::set_level(spdlog::level::warn);
+		fs::remove_all(m_root);
+		fs::create_directories(m_root);
+	}
+
+	fs::path m_root;
+};
+
+static void SyntheticArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"files", "file_size", "jobs"});
+	b->ArgsProduct({SyntheticFiles(), SyntheticFileSizes(), {1, 0}});
+	b->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+static int64_t TreeBytes(const fs::path& root)
+{
+	int64_t size = 0;
+	for(auto& entry : fs::recursive_directory_iterator(root))
+	{
+		if(entry.is_regular_file())
+		{
+			size += static_cast<int64_t>(entry.file_size());
+		}
+	}
+	return size;
+}
+
+static void BM_Pack(benchmark::State& state)
+{
+	auto& data = SyntheticData::instance();
+	fs::path tree = data.tree(state.range(0), state.range(1));
+	std::string out = data.scratch("pack.db").string();
+
+	for(auto _ : state)
+	{
+		db_packer packer;
+		packer.set_jobs(static_cast<unsigned int>(state.range(2)));
+		packer.process(tree.string() + "/", out, db_tools::DB_VERSION_2947RU, "");
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * TreeBytes(tree));
+	fs::remove(out);
+}
+
+BENCHMARK(BM_Pack)->Apply(SyntheticArgs);
+
+static void BM_Unpack(benchmark::State& state)
+{
+	auto& data = SyntheticData::instance();
+	std::string archive = data.archive(state.range(0), state.range(1), db_tools::DB_VERSION_2947RU);
+	fs::path out = data.scratch("unpack");
+
+	for(auto _ : state)
+	{
+		db_unpacker unpacker;
+		unpacker.set_jobs(static_cast<unsigned int>(state.range(2)));
+		unpacker.process(archive, out.string(), db_tools::DB_VERSION_2947RU, "");
+
+		state.PauseTiming();
+		fs::remove_all(out);
+		state.ResumeTiming();
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(fs::file_size(archive)));
+}
+
+BENCHMARK(BM_Unpack)->Apply(SyntheticArgs);
+
+// reading the header: descrambling, LZHUF decoding, parsing the records and sorting the index
+static void BM_OpenArchive(benchmark::State& state)
+{
+	auto files = static_cast<uint64_t>(state.range(0));
+	auto version = static_cast<db_tools::db_version>(state.range(1));
+	std::string archive = SyntheticData::instance().scratch("open_" + std::to_string(files) + "_" + std::to_string(version) + ".db").string();
+
+	if(!fs::exists(archive))
+	{
+		db_generator::settings settings;
+		settings.files = files;
+		settings.size_median = 256;
+
+		db_generator generator;
+		generator.set_jobs(0);
+		generator.set_settings(settings);
+		generator.process(archive, version);
+	}
+
+	for(auto _ : state)
+	{
+		db_archive a;
+		a.open(archive, version);
+		benchmark::DoNotOptimize(a.files().data());
+	}
+
+	state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0));
+}
+
+BENCHMARK(BM_OpenArchive)->ArgNames({"files", "version"})->ArgsProduct({{1 << 10, 64 << 10},
+	{db_tools::DB_VERSION_1114, db_tools::DB_VERSION_2215, db_tools::DB_VERSION_2945, db_tools::DB_VERSION_2947RU, db_tools::DB_VERSION_2947WW, db_tools::DB_VERSION_XDB}});
@@ -0,0 +1,54 @@
+#include "crc32/crc32.hxx"
+#include "xray_re/xr_hash.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+static void BM_CRC32(benchmark::State& state)
+{
+	auto implementation = static_cast<crc32_implementation>(state.range(0));
+	if(!crc32_supported(implementation))
+	{
+		state.SkipWithError("not supported by this CPU");
+		return;
+	}
+
+	std::vector<uint8_t> data(static_cast<size_t>(state.range(1)));
+	std::mt19937 random(1);
+	for(auto& byte : data)
+	{
+		byte = static_cast<uint8_t>(random());
+	}
+
+	for(auto _ : state)
+	{
+		benchmark::DoNotOptimize(crc32_update(implementation, 0, data.data(), data.size()));
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(data.size()));
+}
+
+BENCHMARK(BM_CRC32)->ArgsProduct({{CRC32_BYTEWISE, CRC32_SLICING_BY_8, CRC32_PCLMUL}, {4 << 10, 1 << 20}});
+
+// the dedup candidate hash, for comparison with the CRC that confirms it
+static void BM_Hash64(benchmark::State& state)
+{
+	std::vector<uint8_t> data(static_cast<size_t>(state.range(0)));
+	std::mt19937 random(1);
+	for(auto& byte : data)
+	{
+		byte = static_cast<uint8_t>(random());
+	}
+
+	for(auto _ : state)
+	{
+		benchmark::DoNotOptimize(xray_re::xr_hash64(data.data(), data.size()));
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(data.size()));
+}
+
+BENCHMARK(BM_Hash64)->Arg(4 << 10)->Arg(1 << 20);
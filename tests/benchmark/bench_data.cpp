@@ -0,0 +1,86 @@
+#include "bench_data.hxx"
+
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+
+std::vector<uint8_t> MakeText(size_t size, unsigned int seed)
+{
+	std::mt19937 random(seed);
+	std::vector<uint8_t> text;
+	text.reserve(size);
+
+	static const char *words[] = {"[section]", "visual", "= ", "meshes\\dynamics\\", "textures\\", ".ogf", ".dds", "\r\n", "; ", "0.5, ", "true", "inv_weight", "cost"};
+	while(text.size() < size)
+	{
+		if(random() % 8 == 0)
+		{
+			text.push_back(static_cast<uint8_t>('a' + random() % 26));
+			continue;
+		}
+
+		for(const char *p = words[random() % (sizeof(words)/sizeof(words[0]))]; *p && text.size() < size; ++p)
+		{
+			text.push_back(static_cast<uint8_t>(*p));
+		}
+	}
+	return text;
+}
+
+std::vector<uint8_t> MakeNoise(size_t size, unsigned int seed)
+{
+	std::mt19937 random(seed);
+	std::vector<uint8_t> data(size);
+	for(auto& byte : data)
+	{
+		byte = static_cast<uint8_t>(random());
+	}
+	return data;
+}
+
+void MakeTree(const std::filesystem::path& root, size_t files, size_t file_size, unsigned int seed)
+{
+	static const char *folders[] = {"config", "meshes", "scripts", "sounds", "spawns", "textures"};
+	std::mt19937 random(seed);
+
+	for(size_t i = 0; i < files; ++i)
+	{
+		size_t size = file_size / 2 + random() % (file_size + 1);
+		bool text = i % 4 == 0;
+
+		std::filesystem::path path = root / folders[i % 6] / ("group_" + std::to_string(i / 64)) / ("file_" + std::to_string(i) + (text ? ".ltx" : ".dds"));
+		std::filesystem::create_directories(path.parent_path());
+
+		auto data = text ? MakeText(size, seed + static_cast<unsigned int>(i)) : MakeNoise(size, seed + static_cast<unsigned int>(i));
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+	}
+}
+
+static std::vector<int64_t> FromEnvironment(const char *name, std::vector<int64_t> defaults)
+{
+	const char *value = std::getenv(name);
+	if(value == nullptr || *value == '\0')
+	{
+		return defaults;
+	}
+
+	std::vector<int64_t> result;
+	std::istringstream list(value);
+	for(std::string item; std::getline(list, item, ',');)
+	{
+		result.push_back(std::stoll(item));
+	}
+	return result;
+}
+
+std::vector<int64_t> SyntheticFiles()
+{
+	return FromEnvironment("DB_BENCH_FILES", {256, 2048});
+}
+
+std::vector<int64_t> SyntheticFileSizes()
+{
+	return FromEnvironment("DB_BENCH_FILE_SIZE", {16 << 10});
+}
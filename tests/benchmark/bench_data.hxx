@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Deterministic inputs shared by the benchmarks, so that runs on different machines and
+// revisions measure the same work and no game data is needed.
+
+// config-like text with some noise, close to what archive headers and .ltx files look like
+std::vector<uint8_t> MakeText(size_t size, unsigned int seed = 42);
+// incompressible bytes, like the textures and sounds that make up most of an archive
+std::vector<uint8_t> MakeNoise(size_t size, unsigned int seed = 1);
+
+// Writes a gamedata-like tree of `files` files of file_size / 2 .. file_size * 3 / 2 bytes under
+// root, a quarter of them text. The same arguments always give the same tree.
+void MakeTree(const std::filesystem::path& root, size_t files, size_t file_size, unsigned int seed = 7);
+
+// Sizes of the synthetic trees: DB_BENCH_FILES and DB_BENCH_FILE_SIZE (comma-separated lists)
+// override the defaults, so bigger trees can be measured without rebuilding.
+std::vector<int64_t> SyntheticFiles();
+std::vector<int64_t> SyntheticFileSizes();
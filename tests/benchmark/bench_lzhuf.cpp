@@ -0,0 +1,63 @@
+#include "bench_data.hxx"
+#include "xray_re/xr_lzhuf.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <vector>
+
+using namespace xray_re;
+
+static std::vector<uint8_t> MakeCode(const std::vector<uint8_t>& text)
+{
+	uint8_t *code = nullptr;
+	uint32_t code_size = 0;
+	_lzhuf lzhuf;
+	lzhuf.Encode(code, code_size, text.data(), static_cast<uint32_t>(text.size()));
+	std::vector<uint8_t> result(code, code + code_size);
+	free(code);
+	return result;
+}
+
+template<void (_lzhuf::*decode)(uint8_t*&, uint32_t&, const uint8_t*, uint32_t)>
+static void BM_LZHUF_Decode(benchmark::State& state)
+{
+	auto text = MakeText(static_cast<size_t>(state.range(0)));
+	auto code = MakeCode(text);
+	_lzhuf lzhuf;
+
+	for(auto _ : state)
+	{
+		uint8_t *out = nullptr;
+		uint32_t out_size = 0;
+		(lzhuf.*decode)(out, out_size, code.data(), static_cast<uint32_t>(code.size()));
+		benchmark::DoNotOptimize(out);
+		free(out);
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(text.size()));
+}
+
+BENCHMARK_TEMPLATE(BM_LZHUF_Decode, &_lzhuf::DecodeBitwise)->Arg(64 << 10)->Arg(4 << 20);
+BENCHMARK_TEMPLATE(BM_LZHUF_Decode, &_lzhuf::Decode)->Arg(64 << 10)->Arg(4 << 20);
+
+static void BM_LZHUF_Encode(benchmark::State& state)
+{
+	auto level = static_cast<unsigned int>(state.range(0));
+	auto text = MakeText(static_cast<size_t>(state.range(1)));
+	_lzhuf lzhuf;
+	uint32_t code_size = 0;
+
+	for(auto _ : state)
+	{
+		uint8_t *code = nullptr;
+		lzhuf.Encode(code, code_size, text.data(), static_cast<uint32_t>(text.size()), level);
+		benchmark::DoNotOptimize(code);
+		free(code);
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(text.size()));
+	state.counters["ratio"] = double(code_size) / double(text.size());
+}
+
+BENCHMARK(BM_LZHUF_Encode)->ArgsProduct({benchmark::CreateDenseRange(_lzhuf::LEVEL_REFERENCE, _lzhuf::LEVEL_BEST, 1), {1 << 20}});
@@ -0,0 +1,31 @@
+#include "bench_data.hxx"
+#include "lzo/minilzo.h"
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+// entries of 2945 and later archives that don't come out smaller are stored, the rest are LZO
+static void BM_LZO_Decompress(benchmark::State& state)
+{
+	auto text = MakeText(static_cast<size_t>(state.range(0)));
+
+	lzo_init();
+	std::vector<uint8_t> code(text.size() + text.size() / 16 + 64 + 3);
+	std::vector<uint8_t> work(LZO1X_1_MEM_COMPRESS);
+	lzo_uint code_size = code.size();
+	lzo1x_1_compress(text.data(), text.size(), code.data(), &code_size, work.data());
+
+	std::vector<uint8_t> out(text.size());
+	for(auto _ : state)
+	{
+		lzo_uint out_size = out.size();
+		lzo1x_decompress_safe(code.data(), code_size, out.data(), &out_size, nullptr);
+		benchmark::DoNotOptimize(out.data());
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(text.size()));
+	state.counters["ratio"] = double(code_size) / double(text.size());
+}
+
+BENCHMARK(BM_LZO_Decompress)->Arg(64 << 10)->Arg(4 << 20);
@@ -0,0 +1,39 @@
+#include "xray_re/xr_scrambler.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace xray_re;
+
+template<bool decrypt>
+static void BM_Scrambler(benchmark::State& state)
+{
+	auto impl = static_cast<xr_scrambler::implementation>(state.range(0));
+	if(!xr_scrambler::supported(impl))
+	{
+		state.SkipWithError("not supported by this CPU");
+		return;
+	}
+
+	xr_scrambler scrambler(xr_scrambler::CC_WW);
+	std::vector<uint8_t> src(static_cast<size_t>(state.range(1)), 0x5a), dest(src.size());
+
+	for(auto _ : state)
+	{
+		if(decrypt)
+		{
+			scrambler.decrypt(dest.data(), src.data(), src.size(), impl);
+		}
+		else
+		{
+			scrambler.encrypt(dest.data(), src.data(), src.size(), impl);
+		}
+		benchmark::DoNotOptimize(dest.data());
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(src.size()));
+}
+
+BENCHMARK_TEMPLATE(BM_Scrambler, true)->ArgsProduct({{xr_scrambler::IMPL_BYTEWISE, xr_scrambler::IMPL_BLOCK, xr_scrambler::IMPL_AVX2}, {4 << 20}});
+BENCHMARK_TEMPLATE(BM_Scrambler, false)->ArgsProduct({{xr_scrambler::IMPL_BYTEWISE, xr_scrambler::IMPL_BLOCK, xr_scrambler::IMPL_AVX2}, {4 << 20}});
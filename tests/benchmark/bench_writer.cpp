@@ -0,0 +1,58 @@
+#include "bench_data.hxx"
+#include "xray_re/xr_writer.hxx"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+using namespace xray_re;
+
+// the packer's file table: a few small fields and a name per entry
+static void BM_MemoryWriter_Records(benchmark::State& state)
+{
+	auto records = static_cast<size_t>(state.range(0));
+	std::string name = "textures\\act\\act_stalker_head_mask.dds";
+
+	for(auto _ : state)
+	{
+		xr_memory_writer w;
+		for(size_t i = 0; i < records; ++i)
+		{
+			w.w_size_u16(name.size() + 16);
+			w.w_u32(static_cast<uint32_t>(i));
+			w.w_u32(static_cast<uint32_t>(i));
+			w.w_u32(0xdeadbeef);
+			w.w_raw(name.data(), name.size());
+			w.w_u32(static_cast<uint32_t>(i * 4096));
+		}
+		benchmark::DoNotOptimize(w.data());
+	}
+
+	state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(records));
+}
+
+BENCHMARK(BM_MemoryWriter_Records)->Arg(1 << 10)->Arg(64 << 10);
+
+// whole files appended inside a chunk
+static void BM_MemoryWriter_Blobs(benchmark::State& state)
+{
+	auto blob = MakeNoise(static_cast<size_t>(state.range(0)));
+	const size_t total = 16 << 20;
+
+	for(auto _ : state)
+	{
+		xr_memory_writer w;
+		w.open_chunk(0);
+		for(size_t written = 0; written < total; written += blob.size())
+		{
+			w.w_raw(blob.data(), blob.size());
+		}
+		w.close_chunk();
+		benchmark::DoNotOptimize(w.data());
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(total));
+}
+
+BENCHMARK(BM_MemoryWriter_Blobs)->Arg(4 << 10)->Arg(1 << 20);
@@ -0,0 +1,69 @@
+#include "crc32/crc32.hxx"
+
+#include <gtest/gtest.h>
+#include <boost/crc.hpp>
+
+#include <random>
+#include <vector>
+
+static std::vector<uint8_t> MakeData(size_t size)
+{
+	std::mt19937 random(static_cast<unsigned int>(size));
+	std::vector<uint8_t> data(size);
+	for(auto& byte : data)
+	{
+		byte = static_cast<uint8_t>(random());
+	}
+	return data;
+}
+
+static unsigned int BoostChecksum(const uint8_t *data, size_t size)
+{
+	boost::crc_32_type result;
+	result.process_bytes(data, size);
+	return result.checksum();
+}
+
+TEST(CRC32, KnownValue)
+{
+	EXPECT_EQ(crc32("123456789", 9), 0xcbf43926u);
+	EXPECT_EQ(crc32("", 0), 0u);
+}
+
+TEST(CRC32, ImplementationsAgree)
+{
+	auto data = MakeData(70000);
+	for(auto implementation : {CRC32_BYTEWISE, CRC32_SLICING_BY_8, CRC32_PCLMUL})
+	{
+		if(!crc32_supported(implementation))
+		{
+			continue;
+		}
+
+		// unaligned starts and every tail length around the block sizes
+		for(size_t offset : {0, 1, 3, 7, 15})
+		{
+			for(size_t size : {0, 1, 7, 8, 15, 16, 63, 64, 65, 127, 128, 129, 1000, 4096, 65537})
+			{
+				EXPECT_EQ(crc32_update(implementation, 0, data.data() + offset, size), BoostChecksum(data.data() + offset, size))
+				    << "implementation " << implementation << " offset " << offset << " size " << size;
+			}
+		}
+	}
+}
+
+TEST(CRC32, Incremental)
+{
+	auto data = MakeData(100000);
+	unsigned int expected = crc32(data.data(), data.size());
+
+	for(size_t block : {1, 13, 64, 4096, 33333})
+	{
+		unsigned int crc = 0;
+		for(size_t pos = 0; pos < data.size(); pos += block)
+		{
+			crc = crc32_update(crc, data.data() + pos, std::min(block, data.size() - pos));
+		}
+		EXPECT_EQ(crc, expected) << "block " << block;
+	}
+}
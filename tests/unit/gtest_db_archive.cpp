@@ -0,0 +1,445 @@
+#include "db_tools.hxx"
+#include "xray_re/xr_file_system.hxx"
+#include "xray_re/xr_lzhuf.hxx"
+#include "xray_re/xr_utils.hxx"
+#include "xray_re/xr_writer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class DbArchive: public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		m_root = fs::temp_directory_path() / ("gtest_db_archive_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+		fs::remove_all(m_root);
+
+		Write("config/system.ltx", "[system]\n");
+		Write("config/weapons/ak74.ltx", std::string(5000, 'a'));
+		Write("scripts/main.script", "function main() end\n");
+		fs::create_directories(m_root / "src" / "empty");
+
+		m_archive_path = (m_root / "test.db").string();
+		db_packer packer;
+		packer.process((m_root / "src").string() + "/", m_archive_path, db_tools::DB_VERSION_2947RU, "");
+	}
+
+	void TearDown() override
+	{
+		fs::remove_all(m_root);
+	}
+
+	void Write(const std::string& path, const std::string& content)
+	{
+		fs::path full = m_root / "src" / path;
+		fs::create_directories(full.parent_path());
+		std::ofstream(full, std::ios::binary) << content;
+	}
+
+	fs::path m_root;
+	std::string m_archive_path;
+};
+
+TEST_F(DbArchive, FindAndRead)
+{
+	db_archive archive;
+	ASSERT_TRUE(archive.open(m_archive_path, db_tools::DB_VERSION_2947RU));
+	EXPECT_EQ(archive.files().size(), 3u);
+
+	const db_tools::db_file *file = archive.find("CONFIG\\Weapons/ak74.LTX");
+	ASSERT_NE(file, nullptr);
+	EXPECT_EQ(file->size_real, 5000u);
+
+	std::vector<uint8_t> buffer;
+	ASSERT_TRUE(archive.read("scripts/main.script", buffer));
+	EXPECT_EQ(std::string(buffer.begin(), buffer.end()), "function main() end\n");
+
+	EXPECT_EQ(archive.find("config/missing.ltx"), nullptr);
+	EXPECT_FALSE(archive.read("config", buffer));
+}
+
+// a filtered archive never keeps the entries the filter rejects, but all of the folders
+TEST_F(DbArchive, Filter)
+{
+	db_filter filter;
+	ASSERT_TRUE(filter.add("config/**"));
+	ASSERT_TRUE(filter.add("!*/weapons/*"));
+
+	db_archive archive;
+	archive.set_filter(&filter);
+	ASSERT_TRUE(archive.open(m_archive_path, db_tools::DB_VERSION_2947RU));
+	ASSERT_EQ(archive.files().size(), 1u);
+	EXPECT_EQ(archive.files()[0].path, "config/system.ltx");
+	EXPECT_EQ(archive.find("scripts/main.script"), nullptr);
+
+	db_archive whole;
+	ASSERT_TRUE(whole.open(m_archive_path, db_tools::DB_VERSION_2947RU));
+	EXPECT_EQ(whole.files().size(), 3u);
+	EXPECT_EQ(archive.folders(), whole.folders());
+}
+
+TEST_F(DbArchive, ForEachPrefix)
+{
+	db_archive archive;
+	ASSERT_TRUE(archive.open(m_archive_path, db_tools::DB_VERSION_2947RU));
+
+	std::vector<std::string> paths;
+	archive.for_each("config/", [&paths](const db_tools::db_file& file) { paths.push_back(file.path); });
+
+	ASSERT_EQ(paths.size(), 2u);
+	EXPECT_EQ(paths[0], "config/system.ltx");
+	EXPECT_EQ(paths[1], "config/weapons/ak74.ltx");
+}
+
+TEST_F(DbArchive, MemoryLimit)
+{
+	db_archive mapped;
+	ASSERT_TRUE(mapped.open(m_archive_path, db_tools::DB_VERSION_2947RU));
+
+	db_archive streamed;
+	streamed.set_memory_limit(1024);
+	ASSERT_TRUE(streamed.open(m_archive_path, db_tools::DB_VERSION_2947RU));
+	ASSERT_EQ(streamed.files().size(), mapped.files().size());
+
+	for(const auto& file : mapped.files())
+	{
+		std::vector<uint8_t> expected, actual;
+		ASSERT_TRUE(mapped.read(file, expected));
+		ASSERT_TRUE(streamed.read(file.path, actual));
+		EXPECT_EQ(expected, actual);
+
+		// a memory writer can't take in-kernel copies, the entry is read in limit-sized pieces
+		xray_re::xr_memory_writer w;
+		size_t copied;
+		ASSERT_TRUE(streamed.extract(file, w, copied));
+		EXPECT_EQ(copied, 0u);
+		ASSERT_EQ(w.tell(), expected.size());
+		EXPECT_TRUE(std::equal(expected.begin(), expected.end(), w.data()));
+	}
+}
+
+// a 1114 compressed entry whose size prefix lies past the end of the archive is left out
+TEST_F(DbArchive, TruncatedSizePrefix)
+{
+	xray_re::xr_memory_writer table;
+	table.w_sz("whole.ltx");
+	table.w_u32(1);
+	table.w_size_u32(8);
+	table.w_size_u32(100);
+	table.w_sz("cut.ltx");
+	table.w_u32(0);
+	table.w_size_u32(100000);
+	table.w_size_u32(100);
+
+	uint8_t *header = nullptr;
+	uint32_t header_size = 0;
+	xray_re::xr_lzhuf::compress(header, header_size, table.data(), static_cast<uint32_t>(table.tell()));
+
+	xray_re::xr_memory_writer w;
+	w.open_chunk(db_tools::DB_CHUNK_DATA);
+	w.w_raw(std::string(100, 'x').data(), 100);
+	w.close_chunk();
+	w.open_chunk(db_tools::DB_CHUNK_HEADER | xray_re::CHUNK_COMPRESSED);
+	w.w_raw(header, header_size);
+	w.close_chunk();
+	free(header);
+
+	std::string path = (m_root / "truncated_1114.db").string();
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(w.data()), w.tell());
+
+	for(size_t limit : {size_t(0), size_t(1024)})
+	{
+		db_archive archive;
+		archive.set_memory_limit(limit);
+		ASSERT_TRUE(archive.open(path, db_tools::DB_VERSION_1114));
+		ASSERT_EQ(archive.files().size(), 1u);
+		EXPECT_EQ(archive.files()[0].path, "whole.ltx");
+		EXPECT_EQ(archive.files()[0].size_real, 100u);
+	}
+}
+
+TEST_F(DbArchive, IncrementalRepack)
+{
+	// the first build against a missing base writes the sidecar that later builds rely on
+	std::string first_path = (m_root / "first.db").string();
+	db_packer first;
+	first.set_base((m_root / "missing.db").string());
+	first.process((m_root / "src").string() + "/", first_path, db_tools::DB_VERSION_2947RU, "");
+
+	db_cache cache;
+	ASSERT_TRUE(cache.load(db_cache::path_for(first_path)));
+	EXPECT_EQ(cache.size(), 3u);
+	ASSERT_NE(cache.find("CONFIG\\system.ltx"), nullptr);
+	EXPECT_EQ(cache.find("config/system.ltx")->size, 9u);
+
+	Write("scripts/main.script", "function main() return 1 end\n");
+
+	std::string second_path = (m_root / "second.db").string();
+	db_packer second;
+	second.set_base(first_path);
+	second.process((m_root / "src").string() + "/", second_path, db_tools::DB_VERSION_2947RU, "");
+
+	std::string full_path = (m_root / "full.db").string();
+	db_packer full;
+	full.process((m_root / "src").string() + "/", full_path, db_tools::DB_VERSION_2947RU, "");
+
+	db_archive incremental, reference;
+	ASSERT_TRUE(incremental.open(second_path, db_tools::DB_VERSION_2947RU));
+	ASSERT_TRUE(reference.open(full_path, db_tools::DB_VERSION_2947RU));
+	ASSERT_EQ(incremental.files().size(), reference.files().size());
+
+	for(const auto& file : reference.files())
+	{
+		std::vector<uint8_t> expected, actual;
+		ASSERT_TRUE(reference.read(file, expected));
+		ASSERT_TRUE(incremental.read(file.path, actual));
+		EXPECT_EQ(expected, actual) << file.path;
+	}
+}
+
+TEST_F(DbArchive, CacheFile)
+{
+	std::string path = (m_root / "files.cache").string();
+
+	db_cache cache;
+	cache.add("Scripts\\main.script", {20, 1, 2, 3, 20, 0xdeadbeef});
+	cache.add("config/system.ltx", {9, 4, 5, 6, 9, 0x12345678});
+	cache.add("config/system.ltx", {10, 7, 8, 9, 10, 0x87654321});
+	ASSERT_TRUE(cache.save(path));
+
+	db_cache loaded;
+	ASSERT_TRUE(loaded.load(path));
+	ASSERT_EQ(loaded.size(), 2u);
+
+	const db_cache::entry *entry = loaded.find("scripts/MAIN.script");
+	ASSERT_NE(entry, nullptr);
+	EXPECT_EQ(entry->inode, 2u);
+	EXPECT_EQ(entry->crc, 0xdeadbeef);
+
+	// the last entry added for a path is kept
+	entry = loaded.find("config/system.ltx");
+	ASSERT_NE(entry, nullptr);
+	EXPECT_EQ(entry->size, 10u);
+	EXPECT_EQ(entry->offset, 9u);
+	EXPECT_EQ(loaded.find("config/missing.ltx"), nullptr);
+
+	fs::resize_file(path, fs::file_size(path) - 1);
+	EXPECT_FALSE(loaded.load(path));
+	EXPECT_EQ(loaded.find("config/system.ltx"), nullptr);
+}
+
+TEST_F(DbArchive, UpdateAndCompact)
+{
+	fs::path update = m_root / "update";
+	fs::create_directories(update / "config");
+	fs::create_directories(update / "textures");
+	std::ofstream(update / "config" / "system.ltx", std::ios::binary) << "[system]\nchanged = true\n";
+	std::ofstream(update / "textures" / "new.dds", std::ios::binary) << std::string(3000, 't');
+
+	auto size = fs::file_size(m_archive_path);
+
+	db_updater updater;
+	updater.process(update.string(), m_archive_path, db_tools::DB_VERSION_2947RU);
+	EXPECT_GT(fs::file_size(m_archive_path), size);
+
+	auto check = [this]()
+	{
+		db_archive archive;
+		ASSERT_TRUE(archive.open(m_archive_path, db_tools::DB_VERSION_2947RU));
+		EXPECT_EQ(archive.files().size(), 4u);
+
+		std::vector<uint8_t> buffer;
+		ASSERT_TRUE(archive.read("config/system.ltx", buffer));
+		EXPECT_EQ(std::string(buffer.begin(), buffer.end()), "[system]\nchanged = true\n");
+		ASSERT_TRUE(archive.read("textures/new.dds", buffer));
+		EXPECT_EQ(buffer.size(), 3000u);
+		ASSERT_TRUE(archive.read("config/weapons/ak74.ltx", buffer));
+		EXPECT_EQ(std::string(buffer.begin(), buffer.end()), std::string(5000, 'a'));
+	};
+	check();
+
+	// unchanged files aren't appended again
+	size = fs::file_size(m_archive_path);
+	updater.process(update.string(), m_archive_path, db_tools::DB_VERSION_2947RU);
+	EXPECT_EQ(fs::file_size(m_archive_path), size);
+
+	updater.compact(m_archive_path, db_tools::DB_VERSION_2947RU);
+	EXPECT_LT(fs::file_size(m_archive_path), size);
+	check();
+}
+
+// an entry past the end of a truncated archive stops the compaction, the archive stays as it was
+TEST_F(DbArchive, CompactTruncated)
+{
+	struct header_writer: db_tools
+	{
+		using db_tools::write_header;
+	};
+
+	std::string path = (m_root / "truncated.db").string();
+	xray_re::xr_writer *w = xray_re::xr_file_system::instance().w_open(path);
+	ASSERT_NE(w, nullptr);
+	w->open_chunk(db_tools::DB_CHUNK_DATA);
+	w->w_raw(std::string(100, 'x').data(), 100);
+	w->close_chunk();
+
+	db_tools::db_file whole {"whole.ltx", 8, 100, 100, 0, false};
+	db_tools::db_file cut {"cut.ltx", 50, 100000, 100000, 0, false};
+	header_writer::write_header(*w, {}, {&whole, &cut}, db_tools::DB_VERSION_2947RU, 0);
+	xray_re::xr_file_system::instance().w_close(w);
+
+	std::ifstream before_file(path, std::ios::binary);
+	std::string before((std::istreambuf_iterator<char>(before_file)), std::istreambuf_iterator<char>());
+	before_file.close();
+
+	db_updater updater;
+	updater.compact(path, db_tools::DB_VERSION_2947RU);
+
+	std::ifstream after_file(path, std::ios::binary);
+	std::string after((std::istreambuf_iterator<char>(after_file)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(after, before);
+	EXPECT_FALSE(fs::exists(path + ".tmp"));
+}
+
+TEST_F(DbArchive, Dedup)
+{
+	Write("copies/ak74.ltx", std::string(5000, 'a'));
+	Write("copies/almost.ltx", std::string(4999, 'a') + "b");
+
+	std::string path = (m_root / "dedup.db").string();
+	db_packer packer;
+	packer.set_dedup(true);
+	packer.set_jobs(2);
+	packer.process((m_root / "src").string() + "/", path, db_tools::DB_VERSION_2947RU, "");
+
+	db_archive archive;
+	ASSERT_TRUE(archive.open(path, db_tools::DB_VERSION_2947RU));
+	ASSERT_EQ(archive.files().size(), 5u);
+
+	const db_tools::db_file *original = archive.find("config/weapons/ak74.ltx");
+	const db_tools::db_file *copy = archive.find("copies/ak74.ltx");
+	const db_tools::db_file *almost = archive.find("copies/almost.ltx");
+	ASSERT_TRUE(original && copy && almost);
+	EXPECT_EQ(original->offset, copy->offset);
+	EXPECT_NE(original->offset, almost->offset);
+
+	std::vector<uint8_t> buffer;
+	ASSERT_TRUE(archive.read(*almost, buffer));
+	EXPECT_EQ(buffer.back(), 'b');
+	EXPECT_LT(fs::file_size(path), fs::file_size(m_archive_path) + 5000 + 100);
+}
+
+// a new file equal to one reused from the base archive shares its data, whatever the number of jobs
+TEST_F(DbArchive, DedupWithBase)
+{
+	std::string base_path = (m_root / "base.db").string();
+	db_packer first;
+	first.set_base((m_root / "missing.db").string());
+	first.process((m_root / "src").string() + "/", base_path, db_tools::DB_VERSION_2947RU, "");
+
+	Write("copies/ak74.ltx", std::string(5000, 'a'));
+
+	std::string serial;
+	for(unsigned int jobs : {1u, 4u})
+	{
+		std::string path = (m_root / ("dedup" + std::to_string(jobs) + ".db")).string();
+		db_packer packer;
+		packer.set_base(base_path);
+		packer.set_dedup(true);
+		packer.set_jobs(jobs);
+		packer.process((m_root / "src").string() + "/", path, db_tools::DB_VERSION_2947RU, "");
+
+		db_archive archive;
+		ASSERT_TRUE(archive.open(path, db_tools::DB_VERSION_2947RU));
+		const db_tools::db_file *original = archive.find("config/weapons/ak74.ltx");
+		const db_tools::db_file *copy = archive.find("copies/ak74.ltx");
+		ASSERT_TRUE(original && copy);
+		EXPECT_EQ(original->offset, copy->offset);
+		EXPECT_LT(fs::file_size(path), fs::file_size(base_path) + 100);
+
+		std::ifstream file(path, std::ios::binary);
+		std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if(jobs == 1)
+		{
+			serial = bytes;
+		}
+		EXPECT_TRUE(bytes == serial);
+	}
+}
+
+TEST_F(DbArchive, ArchiveSet)
+{
+	fs::remove_all(m_root / "src");
+	Write("config/system.ltx", "[patched]\n");
+	Write("textures/new.dds", "dds");
+
+	std::string patch_path = (m_root / "patch.db").string();
+	db_packer packer;
+	packer.process((m_root / "src").string() + "/", patch_path, db_tools::DB_VERSION_2947RU, "");
+
+	fs::path out = m_root / "out";
+	db_unpacker unpacker;
+	unpacker.set_jobs(2);
+	unpacker.process({m_archive_path, patch_path}, out.string(), db_tools::DB_VERSION_2947RU, db_filter());
+
+	auto read = [&out](const std::string& path)
+	{
+		std::ifstream file(out / path, std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	};
+	EXPECT_EQ(read("config/system.ltx"), "[patched]\n");
+	EXPECT_EQ(read("config/weapons/ak74.ltx"), std::string(5000, 'a'));
+	EXPECT_EQ(read("scripts/main.script"), "function main() end\n");
+	EXPECT_EQ(read("textures/new.dds"), "dds");
+}
+
+TEST_F(DbArchive, Overlay)
+{
+	fs::remove_all(m_root / "src");
+	Write("CONFIG/System.ltx", "[patched]\n");
+	Write("config/zz.ltx", "zz");
+
+	std::string patch_path = (m_root / "patch.db").string();
+	db_packer packer;
+	packer.process((m_root / "src").string() + "/", patch_path, db_tools::DB_VERSION_2947RU, "");
+
+	db_overlay overlay;
+	ASSERT_TRUE(overlay.open({m_archive_path, patch_path}, db_tools::DB_VERSION_2947RU));
+	EXPECT_EQ(overlay.entries().size(), 4u);
+	EXPECT_EQ(overlay.overridden(), 1u);
+
+	const db_overlay::entry *entry = overlay.find("config\\system.ltx");
+	ASSERT_NE(entry, nullptr);
+	EXPECT_EQ(entry->archive, overlay.archives()[1].get());
+
+	db_tools::db_file file;
+	ASSERT_TRUE(overlay.stat("scripts/main.script", file));
+	EXPECT_EQ(file.size_real, 20u);
+	EXPECT_FALSE(overlay.stat("scripts/missing.script", file));
+
+	std::vector<uint8_t> buffer;
+	ASSERT_TRUE(overlay.read("config/system.ltx", buffer));
+	EXPECT_EQ(std::string(buffer.begin(), buffer.end()), "[patched]\n");
+
+	xray_re::xr_reader *reader = overlay.open_reader("config/weapons/ak74.ltx");
+	ASSERT_NE(reader, nullptr);
+	EXPECT_EQ(reader->size(), 5000u);
+	EXPECT_EQ(static_cast<const char*>(reader->data())[4999], 'a');
+	xray_re::xr_file_system::r_close(reader);
+
+	std::vector<std::string> listed;
+	overlay.list("config/", [&listed](const db_overlay::entry& e) { listed.push_back(e.file->path); });
+	ASSERT_EQ(listed.size(), 3u);
+	EXPECT_EQ(db_archive::compare_paths(listed[0], "config/system.ltx"), 0);
+	EXPECT_EQ(db_archive::compare_paths(listed[1], "config/weapons/ak74.ltx"), 0);
+	EXPECT_EQ(db_archive::compare_paths(listed[2], "config/zz.ltx"), 0);
+}
@@ -0,0 +1,151 @@
+#include "db_tools.hxx"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static db_entry_cache::data_ptr make_data(size_t size, uint8_t value)
+{
+	return std::make_shared<std::vector<uint8_t>>(size, value);
+}
+
+TEST(EntryCache, HitsAndMisses)
+{
+	db_entry_cache cache(1000, 1);
+	EXPECT_EQ(cache.find(1, 100), nullptr);
+
+	auto data = make_data(10, 'a');
+	EXPECT_EQ(cache.insert(1, 100, data), data);
+	EXPECT_EQ(cache.find(1, 100), data);
+	EXPECT_EQ(cache.find(2, 100), nullptr);
+
+	// a second insert of the same key keeps the first copy
+	EXPECT_EQ(cache.insert(1, 100, make_data(10, 'b')), data);
+
+	db_entry_cache::stats stats = cache.get_stats();
+	EXPECT_EQ(stats.hits, 1u);
+	EXPECT_EQ(stats.misses, 2u);
+	EXPECT_EQ(stats.entries, 1u);
+	EXPECT_EQ(stats.size, 10u);
+}
+
+TEST(EntryCache, EvictsLeastRecentlyUsed)
+{
+	db_entry_cache cache(300, 1);
+	cache.insert(1, 1, make_data(100, 1));
+	cache.insert(1, 2, make_data(100, 2));
+	cache.insert(1, 3, make_data(100, 3));
+	ASSERT_NE(cache.find(1, 1), nullptr);
+
+	cache.insert(1, 4, make_data(100, 4));
+	EXPECT_NE(cache.find(1, 1), nullptr);
+	EXPECT_EQ(cache.find(1, 2), nullptr);
+	EXPECT_NE(cache.find(1, 3), nullptr);
+	EXPECT_NE(cache.find(1, 4), nullptr);
+
+	// larger than the budget, handed back without being kept
+	auto large = make_data(301, 5);
+	EXPECT_EQ(cache.insert(1, 5, large), large);
+	EXPECT_EQ(cache.find(1, 5), nullptr);
+	EXPECT_EQ(cache.get_stats().evictions, 1u);
+}
+
+TEST(EntryCache, Pinning)
+{
+	db_entry_cache cache(200, 1);
+	cache.insert(1, 1, make_data(100, 1));
+	EXPECT_TRUE(cache.pin(1, 1));
+	EXPECT_FALSE(cache.pin(1, 2));
+
+	cache.insert(1, 2, make_data(100, 2));
+	cache.insert(1, 3, make_data(100, 3));
+	EXPECT_NE(cache.find(1, 1), nullptr);
+	EXPECT_EQ(cache.find(1, 2), nullptr);
+
+	// once unpinned it ages out like any other entry
+	cache.unpin(1, 1);
+	cache.insert(1, 4, make_data(100, 4));
+	cache.insert(1, 5, make_data(100, 5));
+	EXPECT_EQ(cache.find(1, 1), nullptr);
+	EXPECT_LE(cache.get_stats().size, 200u);
+}
+
+TEST(EntryCache, Threads)
+{
+	db_entry_cache cache(64 * 1024, 8);
+
+	std::vector<std::thread> threads;
+	for(uint32_t t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&cache, t]()
+		{
+			for(uint32_t i = 0; i < 2000; ++i)
+			{
+				uint32_t offset = (i * 7 + t) % 300;
+				auto data = cache.find(1, offset);
+				if(data == nullptr)
+				{
+					data = cache.insert(1, offset, make_data(512, static_cast<uint8_t>(offset)));
+				}
+				ASSERT_EQ(data->front(), static_cast<uint8_t>(offset));
+			}
+		});
+	}
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	db_entry_cache::stats stats = cache.get_stats();
+	EXPECT_EQ(stats.hits + stats.misses, 8000u);
+	EXPECT_LE(stats.size, 64u * 1024);
+}
+
+// compressed entries are unpacked once, later reads are copies out of the cache
+TEST(EntryCache, Archive)
+{
+	fs::path root = fs::temp_directory_path() / ("gtest_entry_cache_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+	fs::remove_all(root);
+	fs::create_directories(root);
+
+	db_generator::settings settings;
+	settings.files = 20;
+	settings.size_median = 2000;
+	db_generator generator;
+	generator.set_settings(settings);
+	std::string path = (root / "test.xdb").string();
+	generator.process(path, db_tools::DB_VERSION_XDB);
+
+	db_entry_cache cache(1024 * 1024);
+	db_archive archive;
+	archive.set_cache(&cache);
+	ASSERT_TRUE(archive.open(path, db_tools::DB_VERSION_XDB));
+
+	size_t compressed = 0;
+	std::vector<uint8_t> expected, actual;
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		for(uint64_t index = 0; index < settings.files; ++index)
+		{
+			const db_tools::db_file& file = archive.files()[index];
+			compressed += pass == 0 && archive.is_compressed(file);
+
+			generator.entry_data(index, expected);
+			ASSERT_TRUE(archive.read(file, actual));
+			ASSERT_EQ(actual, expected) << file.path;
+		}
+	}
+
+	ASSERT_GT(compressed, 0u);
+	db_entry_cache::stats stats = cache.get_stats();
+	EXPECT_EQ(stats.misses, compressed);
+	EXPECT_EQ(stats.hits, compressed);
+
+	archive.close();
+	fs::remove_all(root);
+}
@@ -0,0 +1,94 @@
+#include "xray_re/xr_file_system.hxx"
+#include "xray_re/xr_writer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace xray_re;
+
+namespace fs = std::filesystem;
+
+static void WriteSample(xr_writer& w)
+{
+	std::vector<uint8_t> blob(100000);
+	for(size_t i = 0; i < blob.size(); ++i)
+	{
+		blob[i] = static_cast<uint8_t>(i * 7);
+	}
+
+	w.open_chunk(1);
+	for(uint32_t i = 0; i < 5000; ++i)
+	{
+		w.w_u32(i);
+		w.w_u16(static_cast<uint16_t>(i));
+	}
+	w.open_chunk(2);
+	w.w_raw(blob.data(), blob.size());
+	w.w_sz("tail");
+	w.close_chunk();
+	w.w_raw(blob.data(), 10);
+	w.close_chunk();
+	w.w_raw_chunk(3, blob.data(), 3);
+}
+
+class FileWriter: public ::testing::TestWithParam<size_t> {};
+
+TEST_P(FileWriter, MatchesMemoryWriter)
+{
+	xr_memory_writer expected;
+	WriteSample(expected);
+
+	std::string path = (fs::temp_directory_path() / ("gtest_file_writer_" + std::to_string(GetParam()))).string();
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+	ASSERT_NE(fd, -1);
+	{
+		xr_file_writer_posix w(fd, GetParam());
+		WriteSample(w);
+		EXPECT_EQ(w.tell(), expected.tell());
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	std::vector<uint8_t> actual((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	fs::remove(path);
+
+	ASSERT_EQ(actual.size(), expected.tell());
+	EXPECT_TRUE(std::equal(actual.begin(), actual.end(), expected.data()));
+}
+
+INSTANTIATE_TEST_SUITE_P(BufferSizes, FileWriter, ::testing::Values(0, 1, 7, 4096, xr_file_writer_posix::DEFAULT_BUFFER_SIZE, 1 << 20));
+
+TEST(DirectWriter, MatchesMemoryWriter)
+{
+	xr_memory_writer expected;
+	WriteSample(expected);
+
+	fs::path path = fs::temp_directory_path() / "gtest_direct_writer";
+	xr_file_system file_system;
+	ASSERT_TRUE(file_system.initialize(""));
+
+	xr_writer *w = file_system.w_open_direct_at(AT_FDCWD, path.string());
+	if(w == nullptr)
+	{
+		GTEST_SKIP() << "O_DIRECT is not supported for " << path;
+	}
+
+	w->reserve(expected.tell());
+	WriteSample(*w);
+	EXPECT_EQ(w->tell(), expected.tell());
+	xr_file_system::w_close(w);
+
+	std::ifstream file(path, std::ios::binary);
+	std::vector<uint8_t> actual((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	fs::remove(path);
+
+	ASSERT_EQ(actual.size(), expected.tell());
+	EXPECT_TRUE(std::equal(actual.begin(), actual.end(), expected.data()));
+}
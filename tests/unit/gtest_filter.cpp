@@ -0,0 +1,156 @@
+#include "db_tools.hxx"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static bool matches(const std::vector<std::string>& patterns, const std::string& path)
+{
+	db_filter filter;
+	for(const auto& pattern : patterns)
+	{
+		EXPECT_TRUE(filter.add(pattern)) << pattern;
+	}
+	return filter.match(path);
+}
+
+TEST(Filter, Empty)
+{
+	db_filter filter;
+	EXPECT_TRUE(filter.empty());
+	EXPECT_TRUE(filter.match("config/system.ltx"));
+	EXPECT_TRUE(filter.match(""));
+}
+
+TEST(Filter, Substring)
+{
+	EXPECT_TRUE(matches({"system"}, "config/system.ltx"));
+	EXPECT_TRUE(matches({"CONFIG\\"}, "config/system.ltx"));
+	EXPECT_FALSE(matches({"weapons"}, "config/system.ltx"));
+}
+
+TEST(Filter, Globs)
+{
+	EXPECT_TRUE(matches({"config/*.ltx"}, "config/system.ltx"));
+	EXPECT_FALSE(matches({"config/*.ltx"}, "config/weapons/ak74.ltx"));
+	EXPECT_FALSE(matches({"config/*.ltx"}, "config/system.ltx.bak"));
+	EXPECT_TRUE(matches({"config/**.ltx"}, "config/weapons/ak74.ltx"));
+	EXPECT_TRUE(matches({"config/**/*.ltx"}, "config/system.ltx"));
+	EXPECT_TRUE(matches({"config/**/*.ltx"}, "config/weapons/ak74.ltx"));
+	EXPECT_FALSE(matches({"config/**/*.ltx"}, "configs/system.ltx"));
+	EXPECT_TRUE(matches({"**/ak??.ltx"}, "config/weapons/ak74.ltx"));
+	EXPECT_FALSE(matches({"**/ak?.ltx"}, "config/weapons/ak74.ltx"));
+	EXPECT_TRUE(matches({"Textures/*/*.DDS"}, "textures/act/act_stalker.dds"));
+}
+
+TEST(Filter, Sets)
+{
+	EXPECT_TRUE(matches({"levels/l0[1-3]*/**"}, "levels/l02_garbage/level.ltx"));
+	EXPECT_FALSE(matches({"levels/l0[1-3]*/**"}, "levels/l05_bar/level.ltx"));
+	EXPECT_TRUE(matches({"levels/l0[!1-3]*/**"}, "levels/l05_bar/level.ltx"));
+	EXPECT_TRUE(matches({"a[]]b"}, "a]b"));
+	EXPECT_FALSE(matches({"a[!x]b"}, "a/b"));
+	// an unclosed bracket is a literal
+	EXPECT_TRUE(matches({"a[*"}, "a[bc"));
+}
+
+TEST(Filter, Excludes)
+{
+	EXPECT_TRUE(matches({"!*.dds"}, "config/system.ltx"));
+	EXPECT_FALSE(matches({"!**.dds"}, "textures/wm.dds"));
+	EXPECT_TRUE(matches({"config/**", "!**/weapons/**"}, "config/system.ltx"));
+	EXPECT_FALSE(matches({"config/**", "!**/weapons/**"}, "config/weapons/ak74.ltx"));
+	EXPECT_FALSE(matches({"config/**", "!**/weapons/**"}, "scripts/main.script"));
+}
+
+TEST(Filter, Regexes)
+{
+	EXPECT_TRUE(matches({"re:^config/.*\\.ltx$"}, "Config/system.ltx"));
+	EXPECT_FALSE(matches({"re:^config/.*\\.ltx$"}, "scripts/main.script"));
+	EXPECT_TRUE(matches({"scripts/**", "re:ak[0-9]+"}, "config/weapons/ak74.ltx"));
+	EXPECT_FALSE(matches({"**", "!re:ak[0-9]+"}, "config/weapons/ak74.ltx"));
+
+	db_filter filter;
+	EXPECT_FALSE(filter.add("re:("));
+	EXPECT_FALSE(filter.add("!"));
+}
+
+TEST(Filter, Load)
+{
+	fs::path path = fs::temp_directory_path() / ("gtest_filter_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+	std::ofstream(path) << "# configs without weapons\n\nconfig/**\r\n  !**/weapons/**  \n";
+
+	db_filter filter;
+	ASSERT_TRUE(filter.load(path.string()));
+	EXPECT_TRUE(filter.match("config/system.ltx"));
+	EXPECT_FALSE(filter.match("config/weapons/ak74.ltx"));
+	EXPECT_FALSE(filter.match("scripts/main.script"));
+
+	fs::remove(path);
+	EXPECT_FALSE(filter.load(path.string()));
+}
+
+// sets of patterns whose DFA outgrows the state limit fall back to matching without it
+TEST(Filter, ManyPatterns)
+{
+	db_filter small, large;
+	std::vector<std::string> paths;
+	for(int i = 0; i < 100; ++i)
+	{
+		std::string name = "file_" + std::to_string(i * 7919 % 1000);
+		small.add("**/" + name + ".ltx");
+		large.add("*" + std::to_string(i) + "*/**" + name + "*");
+		paths.push_back("folder/" + name + ".ltx");
+		paths.push_back("f" + std::to_string(i) + "x/sub/" + name + "_1.ltx");
+	}
+
+	for(const auto& path : paths)
+	{
+		bool expected = false;
+		for(int i = 0; i < 100; ++i)
+		{
+			std::string name = "file_" + std::to_string(i * 7919 % 1000);
+			expected |= path == "folder/" + name + ".ltx";
+		}
+		EXPECT_EQ(small.match(path), expected) << path;
+		EXPECT_TRUE(large.match(path) || path.compare(0, 7, "folder/") == 0) << path;
+	}
+	EXPECT_FALSE(small.match("folder/file_1.ltx.bak"));
+}
+
+// every thread matches on its own DFA, so they agree without a lock
+TEST(Filter, Threads)
+{
+	db_filter filter;
+	ASSERT_TRUE(filter.add("**/*.ltx"));
+	ASSERT_TRUE(filter.add("!config/weapons/**"));
+
+	std::vector<int> matched(4);
+	std::vector<std::thread> threads;
+	for(size_t t = 0; t < matched.size(); ++t)
+	{
+		threads.emplace_back([&filter, &matched, t]()
+		{
+			for(int i = 0; i < 1000; ++i)
+			{
+				std::string folder = i % 2 ? "config/weapons/" : "config/misc/";
+				matched[t] += filter.match(folder + "file_" + std::to_string(i) + ".ltx");
+			}
+		});
+	}
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	for(int count : matched)
+	{
+		EXPECT_EQ(count, 500);
+	}
+}
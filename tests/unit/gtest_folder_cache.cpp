@@ -0,0 +1,94 @@
+#include "xray_re/xr_file_system.hxx"
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace xray_re;
+
+namespace fs = std::filesystem;
+
+TEST(FolderCache, CreatesParentsOnce)
+{
+	fs::path root = fs::temp_directory_path() / "gtest_folder_cache";
+	fs::remove_all(root);
+	fs::create_directories(root / "existing");
+
+	xr_folder_cache folders;
+	ASSERT_TRUE(folders.create(root.string(), {"a/b/c", "a/b/c", "x/", "a/d", "existing", "", "a/b-c/e"}));
+	EXPECT_EQ(folders.size(), 8u);
+
+	for(const char *folder : {"a", "a/b", "a/b/c", "a/d", "x", "existing", "a/b-c", "a/b-c/e"})
+	{
+		EXPECT_TRUE(fs::is_directory(root / folder)) << folder;
+		EXPECT_NE(folders.fd(folder), -1) << folder;
+	}
+	EXPECT_EQ(folders.fd("missing"), -1);
+	EXPECT_NE(folders.fd(""), -1);
+
+	int fd = openat(folders.fd("a/b/c"), "file", O_WRONLY | O_CREAT, 0666);
+	ASSERT_NE(fd, -1);
+	close(fd);
+	EXPECT_TRUE(fs::is_regular_file(root / "a" / "b" / "c" / "file"));
+
+	folders.close();
+	fs::remove_all(root);
+}
+
+// more folders than descriptors: a quarter of the limit is kept open, the rest is still made
+TEST(FolderCache, LowDescriptorLimit)
+{
+	fs::path root = fs::temp_directory_path() / "gtest_folder_cache_limit";
+	fs::remove_all(root);
+	fs::create_directories(root);
+
+	struct rlimit saved {};
+	ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &saved), 0);
+	struct rlimit limit = saved;
+	limit.rlim_cur = 128;
+	ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+
+	std::vector<std::string> names;
+	for(int i = 0; i < 500; ++i)
+	{
+		names.push_back("f" + std::to_string(i % 20) + "/g" + std::to_string(i));
+	}
+
+	xr_folder_cache folders;
+	EXPECT_TRUE(folders.create(root.string(), names));
+	EXPECT_EQ(folders.size(), 520u);
+
+	size_t open = 0;
+	for(const auto& name : names)
+	{
+		EXPECT_TRUE(fs::is_directory(root / name)) << name;
+		open += folders.fd(name) != -1;
+	}
+	EXPECT_LE(open, 32u);
+
+	// descriptors are left for the files
+	std::vector<int> files;
+	for(int i = 0; i < 64; ++i)
+	{
+		int fd = ::open((root / names[i] / "file").c_str(), O_WRONLY | O_CREAT, 0666);
+		EXPECT_NE(fd, -1) << i;
+		files.push_back(fd);
+	}
+	for(int fd : files)
+	{
+		if(fd != -1)
+		{
+			close(fd);
+		}
+	}
+
+	folders.close();
+	setrlimit(RLIMIT_NOFILE, &saved);
+	fs::remove_all(root);
+}
@@ -0,0 +1,123 @@
+#include "db_tools.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class Generator: public ::testing::TestWithParam<db_tools::db_version>
+{
+protected:
+	void SetUp() override
+	{
+		m_root = fs::temp_directory_path() / ("gtest_generator_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+		fs::remove_all(m_root);
+		fs::create_directories(m_root);
+	}
+
+	void TearDown() override
+	{
+		fs::remove_all(m_root);
+	}
+
+	fs::path m_root;
+};
+
+// every entry reads back as generated, through whichever codec the version uses
+TEST_P(Generator, ReadsBack)
+{
+	db_generator::settings settings;
+	settings.files = 150;
+	settings.size_median = 3000;
+	settings.depth = 2;
+	settings.fan_out = 3;
+	settings.files_per_folder = 10;
+
+	db_generator generator;
+	generator.set_jobs(2);
+	generator.set_settings(settings);
+
+	std::string path = (m_root / "synthetic.db").string();
+	generator.process(path, GetParam());
+
+	db_archive archive;
+	ASSERT_TRUE(archive.open(path, GetParam()));
+	ASSERT_EQ(archive.files().size(), settings.files);
+	EXPECT_FALSE(archive.folders().empty());
+
+	size_t compressed = 0;
+	std::vector<uint8_t> expected, actual;
+	for(uint64_t index = 0; index < settings.files; ++index)
+	{
+		const db_tools::db_file& file = archive.files()[index];
+		ASSERT_EQ(file.path, generator.entry_path(index));
+
+		generator.entry_data(index, expected);
+		ASSERT_TRUE(archive.read(file, actual));
+		ASSERT_EQ(actual, expected) << file.path;
+		compressed += archive.is_compressed(file);
+	}
+	EXPECT_GT(compressed, 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Versions, Generator, ::testing::Values(db_tools::DB_VERSION_1114, db_tools::DB_VERSION_2215, db_tools::DB_VERSION_2945,
+	db_tools::DB_VERSION_2947RU, db_tools::DB_VERSION_2947WW, db_tools::DB_VERSION_XDB));
+
+TEST_F(Generator, Volumes)
+{
+	db_generator::settings settings;
+	settings.files = 40;
+	settings.size_median = 1000;
+	settings.size_sigma = 0;
+	settings.volume_size = 15000;
+
+	db_generator generator;
+	generator.set_settings(settings);
+
+	std::string path = (m_root / "split.db").string();
+	generator.process(path, db_tools::DB_VERSION_XDB);
+	EXPECT_FALSE(fs::exists(path));
+
+	size_t files = 0;
+	for(int volume = 0; volume < 3; ++volume)
+	{
+		db_archive archive;
+		ASSERT_TRUE(archive.open(path + std::to_string(volume), db_tools::DB_VERSION_XDB));
+		EXPECT_LE(archive.files().size(), 15u);
+		files += archive.files().size();
+	}
+	EXPECT_EQ(files, settings.files);
+}
+
+// sizes come from integer arithmetic only, so these hold whatever libm the machine has
+TEST_F(Generator, SizesArePinned)
+{
+	db_generator::settings settings;
+	settings.size_median = 10000;
+	settings.size_sigma = 1.0;
+
+	db_generator generator;
+	generator.set_settings(settings);
+
+	std::vector<uint64_t> sizes;
+	for(uint64_t index = 0; index < 6; ++index)
+	{
+		sizes.push_back(generator.entry_size(index));
+	}
+	EXPECT_EQ(sizes, std::vector<uint64_t>({3707, 19008, 8729, 97550, 16204, 8587}));
+
+	// log-normal around the median
+	std::vector<uint64_t> all;
+	for(uint64_t index = 0; index < 10000; ++index)
+	{
+		all.push_back(generator.entry_size(index));
+	}
+	std::nth_element(all.begin(), all.begin() + all.size() / 2, all.end());
+	EXPECT_NEAR(static_cast<double>(all[all.size() / 2]), 10000.0, 500.0);
+	std::nth_element(all.begin(), all.begin() + all.size() * 84 / 100, all.end());
+	EXPECT_NEAR(static_cast<double>(all[all.size() * 84 / 100]), 27183.0, 2000.0);
+}
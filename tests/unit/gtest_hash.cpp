@@ -0,0 +1,37 @@
+#include "xray_re/xr_hash.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace xray_re;
+
+TEST(Hash64, KnownValue)
+{
+	EXPECT_EQ(xr_hash64("", 0), 0xef46db3751d8e999ull);
+	EXPECT_EQ(xr_hash64("abc", 3), 0x44bc2cf5ad770999ull);
+
+	std::string text = "Nobody inspects the spammish repetition";
+	EXPECT_EQ(xr_hash64(text.data(), text.size()), 0xfbcea83c8a378bf1ull);
+}
+
+TEST(Hash64, IgnoresAlignment)
+{
+	std::vector<uint8_t> data(1000);
+	for(size_t i = 0; i < data.size(); ++i)
+	{
+		data[i] = static_cast<uint8_t>(i * 7);
+	}
+
+	std::vector<uint8_t> shifted(data.size() + 3);
+	std::memcpy(shifted.data() + 3, data.data(), data.size());
+
+	for(size_t size : {0, 1, 4, 7, 8, 31, 32, 33, 100, 1000})
+	{
+		EXPECT_EQ(xr_hash64(data.data(), size), xr_hash64(shifted.data() + 3, size)) << size;
+	}
+
+	EXPECT_NE(xr_hash64(data.data(), data.size()), xr_hash64(data.data(), data.size(), 1));
+}
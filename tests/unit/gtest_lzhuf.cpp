@@ -0,0 +1,144 @@
+#include "xray_re/xr_lzhuf.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace xray_re;
+
+static std::vector<uint8_t> MakeText(size_t size, unsigned int seed)
+{
+	// mix of repeated phrases and noise, so both literals and matches get encoded
+	std::mt19937 random(seed);
+	std::vector<uint8_t> text;
+	text.reserve(size);
+
+	static const char phrase[] = "[section]\r\nvalue = 1.0, 2.0, 3.0 ; comment\r\n";
+	while(text.size() < size)
+	{
+		if(random() % 4 == 0)
+		{
+			text.push_back(static_cast<uint8_t>(random()));
+		}
+		else
+		{
+			size_t start = random() % (sizeof(phrase) - 1);
+			for(size_t i = start; i < sizeof(phrase) - 1 && text.size() < size; ++i)
+			{
+				text.push_back(static_cast<uint8_t>(phrase[i]));
+			}
+		}
+	}
+	return text;
+}
+
+static std::vector<uint8_t> Compress(const std::vector<uint8_t>& text)
+{
+	uint8_t *code = nullptr;
+	uint32_t code_size = 0;
+	xr_lzhuf::compress(code, code_size, text.data(), static_cast<uint32_t>(text.size()));
+	std::vector<uint8_t> result(code, code + code_size);
+	free(code);
+	return result;
+}
+
+static std::vector<uint8_t> Decompress(const std::vector<uint8_t>& code)
+{
+	uint8_t *text = nullptr;
+	uint32_t text_size = 0;
+	xr_lzhuf::decompress(text, text_size, code.data(), static_cast<uint32_t>(code.size()));
+	std::vector<uint8_t> result(text, text + text_size);
+	free(text);
+	return result;
+}
+
+TEST(LZHUF, RoundTrip)
+{
+	for(size_t size : {1, 3, 7, 100, 4096, 65536, 1000003})
+	{
+		auto text = MakeText(size, static_cast<unsigned int>(size));
+		auto code = Compress(text);
+		EXPECT_EQ(Decompress(code), text) << "size " << size;
+	}
+}
+
+TEST(LZHUF, ConcurrentContexts)
+{
+	std::vector<std::vector<uint8_t>> texts;
+	std::vector<std::vector<uint8_t>> codes;
+	for(unsigned int i = 0; i < 8; ++i)
+	{
+		texts.push_back(MakeText(200000 + i*1000, i));
+		codes.push_back(Compress(texts.back()));
+	}
+
+	std::vector<int> failures(texts.size(), 0);
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < texts.size(); ++i)
+	{
+		threads.emplace_back([&, i]()
+		{
+			for(int n = 0; n < 4; ++n)
+			{
+				failures[i] += Compress(texts[i]) != codes[i];
+				failures[i] += Decompress(codes[i]) != texts[i];
+			}
+		});
+	}
+
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	for(size_t i = 0; i < texts.size(); ++i)
+	{
+		EXPECT_EQ(failures[i], 0) << "text " << i;
+	}
+}
+
+TEST(LZHUF, DecodeMatchesBitwiseDecoder)
+{
+	_lzhuf lzhuf;
+	for(size_t size : {1, 2, 61, 4095, 4097, 100000, 3000017})
+	{
+		auto code = Compress(MakeText(size, static_cast<unsigned int>(size) * 7));
+
+		uint8_t *fast = nullptr, *reference = nullptr;
+		uint32_t fast_size = 0, reference_size = 0;
+		lzhuf.Decode(fast, fast_size, code.data(), static_cast<uint32_t>(code.size()));
+		lzhuf.DecodeBitwise(reference, reference_size, code.data(), static_cast<uint32_t>(code.size()));
+
+		ASSERT_EQ(fast_size, reference_size) << "size " << size;
+		EXPECT_EQ(std::vector<uint8_t>(fast, fast + fast_size), std::vector<uint8_t>(reference, reference + reference_size)) << "size " << size;
+		free(fast);
+		free(reference);
+	}
+}
+
+TEST(LZHUF, EveryLevelRoundTrips)
+{
+	_lzhuf lzhuf;
+	for(unsigned int level = _lzhuf::LEVEL_REFERENCE; level <= _lzhuf::LEVEL_BEST; ++level)
+	{
+		for(size_t size : {1, 2, 3, 64, 4096, 70001, 1 << 20})
+		{
+			auto text = MakeText(size, static_cast<unsigned int>(size + level));
+
+			uint8_t *code = nullptr;
+			uint32_t code_size = 0;
+			lzhuf.Encode(code, code_size, text.data(), static_cast<uint32_t>(text.size()), level);
+
+			uint8_t *decoded = nullptr;
+			uint32_t decoded_size = 0;
+			lzhuf.DecodeBitwise(decoded, decoded_size, code, code_size);
+
+			EXPECT_EQ(std::vector<uint8_t>(decoded, decoded + decoded_size), text) << "level " << level << " size " << size;
+			free(code);
+			free(decoded);
+		}
+	}
+}
@@ -0,0 +1,93 @@
+#include "db_tools.hxx"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+
+namespace fs = std::filesystem;
+
+// --jobs only changes who does the work, never the output
+class Parallel: public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		m_root = fs::temp_directory_path() / ("gtest_parallel_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+		fs::remove_all(m_root);
+
+		uint32_t noise = 1;
+		for(int i = 0; i < 60; ++i)
+		{
+			std::string content;
+			for(int j = 0; j < 200 * (i % 7) + i; ++j)
+			{
+				noise = noise * 1664525 + 1013904223;
+				content += i % 2 ? static_cast<char>(noise >> 24) : "[section]\nvalue = 1\n"[j % 20];
+			}
+
+			fs::path path = m_root / "src" / ("folder" + std::to_string(i % 5)) / ("sub" + std::to_string(i % 3)) / ("file" + std::to_string(i) + ".ltx");
+			fs::create_directories(path.parent_path());
+			std::ofstream(path, std::ios::binary) << content;
+		}
+	}
+
+	void TearDown() override
+	{
+		fs::remove_all(m_root);
+	}
+
+	static std::string Read(const fs::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	}
+
+	static std::map<std::string, std::string> Tree(const fs::path& root)
+	{
+		std::map<std::string, std::string> tree;
+		for(const auto& entry : fs::recursive_directory_iterator(root))
+		{
+			tree[fs::relative(entry.path(), root).generic_string()] = entry.is_regular_file() ? Read(entry.path()) : "<folder>";
+		}
+		return tree;
+	}
+
+	fs::path m_root;
+};
+
+TEST_F(Parallel, UnpackMatchesSerial)
+{
+	std::string archive = (m_root / "test.db").string();
+	db_packer packer;
+	packer.process((m_root / "src").string() + "/", archive, db_tools::DB_VERSION_2947RU, "");
+
+	for(unsigned int jobs : {1u, 4u})
+	{
+		db_unpacker unpacker;
+		unpacker.set_jobs(jobs);
+		unpacker.process(archive, (m_root / ("jobs" + std::to_string(jobs))).string() + "/", db_tools::DB_VERSION_2947RU, "");
+	}
+
+	auto serial = Tree(m_root / "jobs1");
+	EXPECT_EQ(serial.size(), 60u + 5 + 15);
+	EXPECT_EQ(Tree(m_root / "jobs4"), serial);
+	EXPECT_EQ(serial, Tree(m_root / "src"));
+}
+
+TEST_F(Parallel, PackMatchesSerial)
+{
+	for(unsigned int jobs : {1u, 4u})
+	{
+		db_packer packer;
+		packer.set_jobs(jobs);
+		packer.process((m_root / "src").string() + "/", (m_root / ("jobs" + std::to_string(jobs) + ".db")).string(), db_tools::DB_VERSION_XDB, "");
+	}
+
+	std::string serial = Read(m_root / "jobs1.db");
+	EXPECT_FALSE(serial.empty());
+	EXPECT_TRUE(Read(m_root / "jobs4.db") == serial);
+}
@@ -0,0 +1,65 @@
+#include "xray_re/xr_scrambler.hxx"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+using namespace xray_re;
+
+static std::vector<uint8_t> MakeData(size_t size)
+{
+	std::mt19937 random(static_cast<unsigned int>(size));
+	std::vector<uint8_t> data(size);
+	for(auto& byte : data)
+	{
+		byte = static_cast<uint8_t>(random());
+	}
+	return data;
+}
+
+TEST(Scrambler, ImplementationsAgree)
+{
+	for(auto cc : {xr_scrambler::CC_RU, xr_scrambler::CC_WW})
+	{
+		xr_scrambler scrambler(cc);
+		for(size_t size : {0, 1, 3, 31, 32, 33, 4095, 4096, 4097, 100000})
+		{
+			auto data = MakeData(size);
+
+			std::vector<uint8_t> encrypted(size), decrypted(size);
+			scrambler.encrypt(encrypted.data(), data.data(), size, xr_scrambler::IMPL_BYTEWISE);
+			scrambler.decrypt(decrypted.data(), data.data(), size, xr_scrambler::IMPL_BYTEWISE);
+
+			for(auto impl : {xr_scrambler::IMPL_BLOCK, xr_scrambler::IMPL_AVX2})
+			{
+				if(!xr_scrambler::supported(impl))
+				{
+					continue;
+				}
+
+				std::vector<uint8_t> out(size);
+				scrambler.encrypt(out.data(), data.data(), size, impl);
+				EXPECT_EQ(out, encrypted) << "encrypt cc " << cc << " impl " << impl << " size " << size;
+
+				scrambler.decrypt(out.data(), data.data(), size, impl);
+				EXPECT_EQ(out, decrypted) << "decrypt cc " << cc << " impl " << impl << " size " << size;
+			}
+		}
+	}
+}
+
+TEST(Scrambler, RoundTripInPlace)
+{
+	for(auto cc : {xr_scrambler::CC_RU, xr_scrambler::CC_WW})
+	{
+		xr_scrambler scrambler(cc);
+		auto data = MakeData(12345);
+		auto buffer = data;
+
+		scrambler.encrypt(buffer.data(), buffer.data(), buffer.size());
+		EXPECT_NE(buffer, data);
+		scrambler.decrypt(buffer.data(), buffer.data(), buffer.size());
+		EXPECT_EQ(buffer, data);
+	}
+}
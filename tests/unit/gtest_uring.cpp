@@ -0,0 +1,104 @@
+#include "xray_re/xr_file_system.hxx"
+#include "xray_re/xr_uring.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace xray_re;
+
+namespace fs = std::filesystem;
+
+static std::string ReadFile(const fs::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+class Uring: public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		m_root = fs::temp_directory_path() / "gtest_uring";
+		fs::remove_all(m_root);
+		fs::create_directories(m_root);
+
+		for(size_t i = 0; i < 300; ++i)
+		{
+			m_contents.push_back(std::string(i * 37, static_cast<char>('a' + i % 26)));
+		}
+	}
+
+	void TearDown() override
+	{
+		fs::remove_all(m_root);
+	}
+
+	std::vector<xr_write_request> MakeRequests(const fs::path& folder) const
+	{
+		std::vector<xr_write_request> requests;
+		for(size_t i = 0; i < m_contents.size(); ++i)
+		{
+			requests.push_back({(folder / ("f" + std::to_string(i))).string(), m_contents[i].data(), m_contents[i].size(), -1});
+		}
+		return requests;
+	}
+
+	void Check(const fs::path& folder, const std::vector<xr_write_request>& requests) const
+	{
+		for(size_t i = 0; i < requests.size(); ++i)
+		{
+			EXPECT_EQ(requests[i].error, 0) << requests[i].path;
+			EXPECT_EQ(ReadFile(folder / ("f" + std::to_string(i))), m_contents[i]);
+		}
+	}
+
+	fs::path m_root;
+	std::vector<std::string> m_contents;
+};
+
+TEST_F(Uring, WritesFiles)
+{
+	if(!xr_uring::supported())
+	{
+		GTEST_SKIP() << "io_uring is not available";
+	}
+
+	auto requests = MakeRequests(m_root);
+	xr_uring ring(16);
+	ring.write_files(requests.data(), requests.size());
+	Check(m_root, requests);
+}
+
+TEST_F(Uring, ReportsFailures)
+{
+	if(!xr_uring::supported())
+	{
+		GTEST_SKIP() << "io_uring is not available";
+	}
+
+	auto requests = MakeRequests(m_root / "missing");
+	xr_uring ring(16);
+	ring.write_files(requests.data(), requests.size());
+	for(const auto& r : requests)
+	{
+		EXPECT_EQ(r.error, ENOENT);
+	}
+}
+
+TEST_F(Uring, FileSystemCreatesFolders)
+{
+	xr_file_system fs;
+	ASSERT_TRUE(fs.initialize("", xr_file_system::FSF_IO_URING));
+
+	fs::path folder = m_root / "a" / "b";
+	auto requests = MakeRequests(folder);
+	fs.write_files(requests.data(), requests.size());
+	Check(folder, requests);
+}